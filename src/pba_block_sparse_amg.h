@@ -0,0 +1,410 @@
+//
+// smoothed aggregation algebraic multigrid for the block sparse matrix
+//
+
+#ifndef PBA_BLOCK_SPARSE_AMG_H_
+#define PBA_BLOCK_SPARSE_AMG_H_
+
+#include <vector>
+#include <climits>
+#include <cassert>
+#include <algorithm>
+#include <Eigen/Dense>
+
+#include "pba_util_eigen.h"
+#include "pba_block_sparse_matrix.h"
+
+namespace pba {
+
+/**
+ * Smoothed aggregation AMG hierarchy used as a preconditioner of the conjugate gradient method.
+ * `initialize` builds the aggregates and the patterns of all the levels from the pattern of the matrix,
+ * and `update` only recomputes the values. Hence the hierarchy can be reused while the pattern is unchanged.
+ * One call of `apply` is a V-cycle with a forward Gauss-Seidel pre-smoothing and a backward Gauss-Seidel
+ * post-smoothing, which keeps the preconditioner symmetric.
+ */
+template<int N>
+class BlockSparseAmg {
+  using Vector = Eigen::Matrix<double, Eigen::Dynamic, N>;
+  using BlockVector = Eigen::Vector<double, N>;
+  using BlockMatrix = Eigen::Matrix<double, N, N>;
+
+  struct Level {
+    BlockSparseMatrix<N> A; // matrix of this level in the full storage
+    std::vector<unsigned int> row2dia; // index of the diagonal block for each row
+    std::vector<BlockMatrix> row2diainv; // inverse of the diagonal blocks
+    std::vector<unsigned int> row2agg; // aggregate (i.e., row in the coarser level) of each row
+    // prolongation from the coarser level
+    std::vector<unsigned int> row2idx_p;
+    std::vector<unsigned int> idx2col_p;
+    std::vector<BlockMatrix> idx2block_p;
+    // transposed pattern of the prolongation. `jdx2idx_p` points to the block in `idx2block_p`
+    std::vector<unsigned int> col2jdx_p;
+    std::vector<unsigned int> jdx2row_p;
+    std::vector<unsigned int> jdx2idx_p;
+  };
+
+ public:
+  /**
+   * build the aggregates and the sparsity patterns of the hierarchy
+   * @param A matrix of the finest level. Either full or symmetric storage
+   * @param num_row_coarsest the coarsening stops when the number of rows is smaller than this
+   * @param max_level maximum number of levels
+   */
+  void initialize(
+      const BlockSparseMatrix<N> &A,
+      unsigned int num_row_coarsest = 64,
+      unsigned int max_level = 10) {
+    levels.clear();
+    levels.emplace_back();
+    idx2src = levels[0].A.initialize_full_pattern(A);
+    while (true) {
+      Level &fine = levels.back();
+      const unsigned int num_row = fine.A.row2idx.size() - 1;
+      fine.row2dia.resize(num_row);
+      for (unsigned int irow = 0; irow < num_row; ++irow) {
+        auto itr0 = fine.A.idx2col.begin() + fine.A.row2idx[irow];
+        auto itr1 = fine.A.idx2col.begin() + fine.A.row2idx[irow + 1];
+        auto itr2 = std::find(itr0, itr1, irow);
+        assert(itr2 != itr1);
+        fine.row2dia[irow] = std::distance(fine.A.idx2col.begin(), itr2);
+      }
+      fine.row2diainv.resize(num_row);
+      if (num_row <= num_row_coarsest || levels.size() >= max_level) { break; }
+      unsigned int num_agg = 0;
+      fine.row2agg = aggregate(num_agg, fine.A.row2idx, fine.A.idx2col);
+      if (num_agg == num_row) { break; } // coarsening stalled
+      set_prolongation_pattern(fine, num_agg);
+      BlockSparseMatrix<N> coarse;
+      set_coarse_pattern(coarse, fine, num_agg);
+      levels.emplace_back();
+      levels.back().A = std::move(coarse);
+    }
+    levels.back().row2agg.clear();
+  }
+
+  /**
+   * recompute the values of the hierarchy from the values of the matrix
+   * @param A matrix with the same pattern as the one given to `initialize`
+   */
+  void update(const BlockSparseMatrix<N> &A) {
+    assert(!levels.empty());
+    {
+      BlockSparseMatrix<N> &A0 = levels[0].A;
+      assert(A0.idx2block.size() == idx2src.size());
+      for (unsigned int idx0 = 0; idx0 < idx2src.size(); ++idx0) {
+        const BlockMatrix &src = A.idx2block[idx2src[idx0] / 2];
+        A0.idx2block[idx0] = (idx2src[idx0] % 2 == 1) ? src.transpose() : src;
+      }
+    }
+    for (unsigned int ilevel = 0; ilevel < levels.size(); ++ilevel) {
+      Level &fine = levels[ilevel];
+      for (unsigned int irow = 0; irow < fine.row2dia.size(); ++irow) {
+        fine.row2diainv[irow] = fine.A.idx2block[fine.row2dia[irow]].inverse();
+      }
+      if (ilevel + 1 == levels.size()) { break; }
+      set_prolongation_value(fine);
+      set_coarse_value(levels[ilevel + 1].A, fine);
+    }
+    { // dense factorization of the coarsest level
+      const BlockSparseMatrix<N> &Ac = levels.back().A;
+      const unsigned int num_row = Ac.row2idx.size() - 1;
+      Eigen::MatrixXd dense = Eigen::MatrixXd::Zero(num_row * N, num_row * N);
+      for (unsigned int irow = 0; irow < num_row; ++irow) {
+        for (unsigned int idx0 = Ac.row2idx[irow]; idx0 < Ac.row2idx[irow + 1]; ++idx0) {
+          dense.block<N, N>(irow * N, Ac.idx2col[idx0] * N) = Ac.idx2block[idx0];
+        }
+      }
+      coarsest_solver.compute(dense);
+    }
+  }
+
+  /**
+   * apply one V-cycle to approximately solve A z = r
+   */
+  void apply(Vector &z, const Vector &r) const {
+    z = Vector::Zero(r.rows(), r.cols());
+    vcycle(z, r, 0);
+  }
+
+  [[nodiscard]] unsigned int num_level() const { return levels.size(); }
+
+ private:
+  /**
+   * greedy aggregation over the graph of the sparsity pattern
+   * @param num_agg (out) number of aggregates
+   * @return aggregate index of each row
+   */
+  static std::vector<unsigned int> aggregate(
+      unsigned int &num_agg,
+      const std::vector<unsigned int> &row2idx,
+      const std::vector<unsigned int> &idx2col) {
+    constexpr unsigned int UNDEF = UINT_MAX;
+    const unsigned int num_row = row2idx.size() - 1;
+    std::vector<unsigned int> row2agg(num_row, UNDEF);
+    num_agg = 0;
+    // a row whose neighbors are all unaggregated makes an aggregate with its neighbors
+    for (unsigned int irow = 0; irow < num_row; ++irow) {
+      if (row2agg[irow] != UNDEF) { continue; }
+      bool is_isolated = true;
+      for (unsigned int idx0 = row2idx[irow]; idx0 < row2idx[irow + 1]; ++idx0) {
+        if (row2agg[idx2col[idx0]] != UNDEF) { is_isolated = false; break; }
+      }
+      if (!is_isolated) { continue; }
+      for (unsigned int idx0 = row2idx[irow]; idx0 < row2idx[irow + 1]; ++idx0) {
+        row2agg[idx2col[idx0]] = num_agg;
+      }
+      num_agg++;
+    }
+    // remaining rows join one of the neighboring aggregates
+    const std::vector<unsigned int> row2agg0 = row2agg;
+    for (unsigned int irow = 0; irow < num_row; ++irow) {
+      if (row2agg[irow] != UNDEF) { continue; }
+      for (unsigned int idx0 = row2idx[irow]; idx0 < row2idx[irow + 1]; ++idx0) {
+        if (row2agg0[idx2col[idx0]] == UNDEF) { continue; }
+        row2agg[irow] = row2agg0[idx2col[idx0]];
+        break;
+      }
+    }
+    // leftovers make new aggregates
+    for (unsigned int irow = 0; irow < num_row; ++irow) {
+      if (row2agg[irow] != UNDEF) { continue; }
+      for (unsigned int idx0 = row2idx[irow]; idx0 < row2idx[irow + 1]; ++idx0) {
+        if (row2agg[idx2col[idx0]] == UNDEF) { row2agg[idx2col[idx0]] = num_agg; }
+      }
+      num_agg++;
+    }
+    return row2agg;
+  }
+
+  /**
+   * pattern of the smoothed prolongation P = (I - omega D^{-1} A) P_tentative and its transpose
+   */
+  static void set_prolongation_pattern(
+      Level &fine,
+      unsigned int num_agg) {
+    const BlockSparseMatrix<N> &A = fine.A;
+    const unsigned int num_row = A.row2idx.size() - 1;
+    fine.row2idx_p.assign(1, 0);
+    fine.idx2col_p.clear();
+    std::vector<unsigned int> cols;
+    for (unsigned int irow = 0; irow < num_row; ++irow) {
+      cols.clear();
+      for (unsigned int idx0 = A.row2idx[irow]; idx0 < A.row2idx[irow + 1]; ++idx0) {
+        cols.push_back(fine.row2agg[A.idx2col[idx0]]);
+      }
+      std::sort(cols.begin(), cols.end());
+      cols.erase(std::unique(cols.begin(), cols.end()), cols.end());
+      fine.idx2col_p.insert(fine.idx2col_p.end(), cols.begin(), cols.end());
+      fine.row2idx_p.push_back(fine.idx2col_p.size());
+    }
+    fine.idx2block_p.resize(fine.idx2col_p.size());
+    // transpose
+    fine.col2jdx_p.assign(num_agg + 1, 0);
+    for (unsigned int icol: fine.idx2col_p) { fine.col2jdx_p[icol + 1] += 1; }
+    for (unsigned int icol = 0; icol < num_agg; ++icol) { fine.col2jdx_p[icol + 1] += fine.col2jdx_p[icol]; }
+    fine.jdx2row_p.resize(fine.idx2col_p.size());
+    fine.jdx2idx_p.resize(fine.idx2col_p.size());
+    std::vector<unsigned int> col2ptr(fine.col2jdx_p.begin(), fine.col2jdx_p.end() - 1);
+    for (unsigned int irow = 0; irow < num_row; ++irow) {
+      for (unsigned int idx0 = fine.row2idx_p[irow]; idx0 < fine.row2idx_p[irow + 1]; ++idx0) {
+        const unsigned int jdx0 = col2ptr[fine.idx2col_p[idx0]]++;
+        fine.jdx2row_p[jdx0] = irow;
+        fine.jdx2idx_p[jdx0] = idx0;
+      }
+    }
+  }
+
+  /**
+   * pattern of the Galerkin coarse matrix P^T A P
+   */
+  static void set_coarse_pattern(
+      BlockSparseMatrix<N> &coarse,
+      const Level &fine,
+      unsigned int num_agg) {
+    const BlockSparseMatrix<N> &A = fine.A;
+    std::vector<unsigned int> col2flag(num_agg, UINT_MAX);
+    std::vector<unsigned int> cols;
+    coarse.is_symmetric = false;
+    coarse.row2idx.assign(1, 0);
+    coarse.idx2col.clear();
+    for (unsigned int iagg = 0; iagg < num_agg; ++iagg) {
+      cols.clear();
+      for (unsigned int jdx0 = fine.col2jdx_p[iagg]; jdx0 < fine.col2jdx_p[iagg + 1]; ++jdx0) {
+        const unsigned int irow = fine.jdx2row_p[jdx0];
+        for (unsigned int idx0 = A.row2idx[irow]; idx0 < A.row2idx[irow + 1]; ++idx0) {
+          const unsigned int jrow = A.idx2col[idx0];
+          for (unsigned int idx1 = fine.row2idx_p[jrow]; idx1 < fine.row2idx_p[jrow + 1]; ++idx1) {
+            const unsigned int jagg = fine.idx2col_p[idx1];
+            if (col2flag[jagg] == iagg) { continue; }
+            col2flag[jagg] = iagg;
+            cols.push_back(jagg);
+          }
+        }
+      }
+      std::sort(cols.begin(), cols.end());
+      coarse.idx2col.insert(coarse.idx2col.end(), cols.begin(), cols.end());
+      coarse.row2idx.push_back(coarse.idx2col.size());
+    }
+    coarse.idx2block.resize(coarse.idx2col.size());
+  }
+
+  /**
+   * largest eigenvalue of D^{-1} A estimated by the power iteration
+   */
+  static double estimate_spectral_radius(const Level &fine) {
+    const unsigned int num_row = fine.row2dia.size();
+    Vector x = Vector::Ones(num_row, N);
+    for (unsigned int irow = 0; irow < num_row; ++irow) {
+      x.row(irow) *= 1.0 + static_cast<double>(irow % 7) * 0.1; // avoid being orthogonal to the eigenvector
+    }
+    Vector Ax(num_row, N);
+    double rho = 1.0;
+    for (unsigned int itr = 0; itr < 10; ++itr) {
+      x /= x.norm();
+      fine.A.multiply_vector(Ax, x);
+      for (unsigned int irow = 0; irow < num_row; ++irow) {
+        BlockVector y0 = fine.row2diainv[irow] * Ax.row(irow).transpose();
+        x.row(irow) = y0.transpose();
+      }
+      rho = x.norm();
+    }
+    return rho;
+  }
+
+  static void set_prolongation_value(Level &fine) {
+    const BlockSparseMatrix<N> &A = fine.A;
+    const unsigned int num_row = A.row2idx.size() - 1;
+    const double omega = 4.0 / (3.0 * estimate_spectral_radius(fine));
+    for (unsigned int irow = 0; irow < num_row; ++irow) {
+      auto itr0 = fine.idx2col_p.begin() + fine.row2idx_p[irow];
+      auto itr1 = fine.idx2col_p.begin() + fine.row2idx_p[irow + 1];
+      for (unsigned int idx1 = fine.row2idx_p[irow]; idx1 < fine.row2idx_p[irow + 1]; ++idx1) {
+        fine.idx2block_p[idx1].setZero();
+        if (fine.idx2col_p[idx1] == fine.row2agg[irow]) { fine.idx2block_p[idx1].setIdentity(); }
+      }
+      const BlockMatrix dia = omega * fine.row2diainv[irow];
+      for (unsigned int idx0 = A.row2idx[irow]; idx0 < A.row2idx[irow + 1]; ++idx0) {
+        const unsigned int jagg = fine.row2agg[A.idx2col[idx0]];
+        const unsigned int idx1 = std::distance(fine.idx2col_p.begin(), std::find(itr0, itr1, jagg));
+        fine.idx2block_p[idx1] -= dia * A.idx2block[idx0];
+      }
+    }
+  }
+
+  /**
+   * values of P^T A P. AP is computed row by row first, then P^T (AP) is computed for each coarse row
+   */
+  static void set_coarse_value(
+      BlockSparseMatrix<N> &coarse,
+      const Level &fine) {
+    const BlockSparseMatrix<N> &A = fine.A;
+    const unsigned int num_row = A.row2idx.size() - 1;
+    const unsigned int num_agg = coarse.row2idx.size() - 1;
+    std::vector<unsigned int> col2ptr(num_agg, UINT_MAX);
+    // AP
+    std::vector<unsigned int> row2idx_ap(1, 0);
+    std::vector<unsigned int> idx2col_ap;
+    std::vector<BlockMatrix> idx2block_ap;
+    for (unsigned int irow = 0; irow < num_row; ++irow) {
+      const unsigned int idx_start = idx2col_ap.size();
+      for (unsigned int idx0 = A.row2idx[irow]; idx0 < A.row2idx[irow + 1]; ++idx0) {
+        const unsigned int jrow = A.idx2col[idx0];
+        for (unsigned int idx1 = fine.row2idx_p[jrow]; idx1 < fine.row2idx_p[jrow + 1]; ++idx1) {
+          const unsigned int jagg = fine.idx2col_p[idx1];
+          if (col2ptr[jagg] == UINT_MAX || col2ptr[jagg] < idx_start) {
+            col2ptr[jagg] = idx2col_ap.size();
+            idx2col_ap.push_back(jagg);
+            idx2block_ap.push_back(BlockMatrix::Zero());
+          }
+          idx2block_ap[col2ptr[jagg]] += A.idx2block[idx0] * fine.idx2block_p[idx1];
+        }
+      }
+      row2idx_ap.push_back(idx2col_ap.size());
+    }
+    // P^T (AP)
+    std::fill(col2ptr.begin(), col2ptr.end(), UINT_MAX);
+    for (unsigned int iagg = 0; iagg < num_agg; ++iagg) {
+      for (unsigned int idx0 = coarse.row2idx[iagg]; idx0 < coarse.row2idx[iagg + 1]; ++idx0) {
+        col2ptr[coarse.idx2col[idx0]] = idx0;
+        coarse.idx2block[idx0].setZero();
+      }
+      for (unsigned int jdx0 = fine.col2jdx_p[iagg]; jdx0 < fine.col2jdx_p[iagg + 1]; ++jdx0) {
+        const unsigned int irow = fine.jdx2row_p[jdx0];
+        const BlockMatrix pt = fine.idx2block_p[fine.jdx2idx_p[jdx0]].transpose();
+        for (unsigned int idx1 = row2idx_ap[irow]; idx1 < row2idx_ap[irow + 1]; ++idx1) {
+          coarse.idx2block[col2ptr[idx2col_ap[idx1]]] += pt * idx2block_ap[idx1];
+        }
+      }
+    }
+  }
+
+  /**
+   * one sweep of the block Gauss-Seidel method
+   * @param is_forward sweep direction
+   */
+  static void smooth(
+      Vector &x,
+      const Vector &b,
+      const Level &level,
+      bool is_forward) {
+    const BlockSparseMatrix<N> &A = level.A;
+    const unsigned int num_row = A.row2idx.size() - 1;
+    for (unsigned int jrow = 0; jrow < num_row; ++jrow) {
+      const unsigned int irow = is_forward ? jrow : num_row - 1 - jrow;
+      BlockVector s = b.row(irow).transpose();
+      for (unsigned int idx0 = A.row2idx[irow]; idx0 < A.row2idx[irow + 1]; ++idx0) {
+        const unsigned int icol = A.idx2col[idx0];
+        if (icol == irow) { continue; }
+        s -= A.idx2block[idx0] * x.row(icol).transpose();
+      }
+      x.row(irow) = (level.row2diainv[irow] * s).transpose();
+    }
+  }
+
+  void vcycle(
+      Vector &x,
+      const Vector &b,
+      unsigned int ilevel) const {
+    const Level &fine = levels[ilevel];
+    if (ilevel + 1 == levels.size()) { // exact solve at the coarsest level
+      const unsigned int num_row = b.rows();
+      Eigen::VectorXd b0(num_row * N);
+      for (unsigned int irow = 0; irow < num_row; ++irow) {
+        b0.segment<N>(irow * N) = b.row(irow).transpose();
+      }
+      const Eigen::VectorXd x0 = coarsest_solver.solve(b0);
+      for (unsigned int irow = 0; irow < num_row; ++irow) {
+        x.row(irow) = x0.segment<N>(irow * N).transpose();
+      }
+      return;
+    }
+    smooth(x, b, fine, true);
+    Vector r(b.rows(), N);
+    fine.A.multiply_vector(r, x);
+    r = b - r;
+    const unsigned int num_agg = levels[ilevel + 1].A.row2idx.size() - 1;
+    Vector bc = Vector::Zero(num_agg, N); // restriction
+    for (unsigned int irow = 0; irow < fine.row2idx_p.size() - 1; ++irow) {
+      for (unsigned int idx0 = fine.row2idx_p[irow]; idx0 < fine.row2idx_p[irow + 1]; ++idx0) {
+        bc.row(fine.idx2col_p[idx0]) += (fine.idx2block_p[idx0].transpose() * r.row(irow).transpose()).transpose();
+      }
+    }
+    Vector xc = Vector::Zero(num_agg, N);
+    vcycle(xc, bc, ilevel + 1);
+    for (unsigned int irow = 0; irow < fine.row2idx_p.size() - 1; ++irow) { // prolongation
+      for (unsigned int idx0 = fine.row2idx_p[irow]; idx0 < fine.row2idx_p[irow + 1]; ++idx0) {
+        x.row(irow) += (fine.idx2block_p[idx0] * xc.row(fine.idx2col_p[idx0]).transpose()).transpose();
+      }
+    }
+    smooth(x, b, fine, false);
+  }
+
+  std::vector<Level> levels;
+  std::vector<unsigned int> idx2src; // input matrix's block for each block at the finest level. see `initialize_full_pattern`
+  Eigen::LDLT<Eigen::MatrixXd> coarsest_solver;
+};
+
+} // namespace pba
+
+#endif //PBA_BLOCK_SPARSE_AMG_H_
@@ -0,0 +1,103 @@
+//
+// sparse direct solver for the block sparse matrix
+//
+
+#ifndef PBA_BLOCK_SPARSE_CHOLESKY_H_
+#define PBA_BLOCK_SPARSE_CHOLESKY_H_
+
+#include <vector>
+#include <cassert>
+#include <Eigen/Dense>
+#include <Eigen/SparseCore>
+#include <Eigen/SparseCholesky>
+#include <Eigen/OrderingMethods>
+
+#include "pba_util_eigen.h"
+#include "pba_block_sparse_matrix.h"
+
+namespace pba {
+
+/**
+ * LDL^T factorization of a symmetric BlockSparseMatrix.
+ * The fill-reducing ordering (AMD) and the symbolic factorization are computed once in `initialize`
+ * since the sparsity pattern does not change. `factorize` only redo the numeric factorization.
+ * Only the upper blocks are read, so both the full and the symmetric storage can be used.
+ */
+template<int N>
+class BlockSparseCholesky {
+  using Vector = Eigen::Matrix<double, Eigen::Dynamic, N>;
+  using SparseMatrix = Eigen::SparseMatrix<double, Eigen::ColMajor, int>;
+ public:
+  void initialize(const BlockSparseMatrix<N> &A) {
+    const unsigned int num_row = A.row2idx.size() - 1;
+    // scalar upper-triangular pattern. The value of the triplet stores the index to the block's entry
+    std::vector<Eigen::Triplet<double, int> > triplets;
+    for (unsigned int irow = 0; irow < num_row; ++irow) {
+      for (unsigned int idx0 = A.row2idx[irow]; idx0 < A.row2idx[irow + 1]; ++idx0) {
+        const unsigned int icol = A.idx2col[idx0];
+        if (icol < irow || icol == BlockSparseMatrix<N>::empty_slot) { continue; }
+        for (int i = 0; i < N; ++i) {
+          for (int j = 0; j < N; ++j) {
+            if (icol == irow && j < i) { continue; }
+            triplets.emplace_back(irow * N + i, icol * N + j, static_cast<double>(idx0 * N * N + i * N + j));
+          }
+        }
+      }
+    }
+    matrix.resize(num_row * N, num_row * N);
+    matrix.setFromTriplets(triplets.begin(), triplets.end());
+    matrix.makeCompressed();
+    val2entry.resize(matrix.nonZeros());
+    for (unsigned int ival = 0; ival < val2entry.size(); ++ival) {
+      val2entry[ival] = static_cast<unsigned int>(matrix.valuePtr()[ival]);
+    }
+    solver.analyzePattern(matrix);
+    assert(solver.info() == Eigen::Success);
+  }
+
+  /**
+   * numeric factorization using the current values in the matrix
+   * @return false if the factorization failed
+   */
+  bool factorize(const BlockSparseMatrix<N> &A) {
+    assert(A.row2idx.size() - 1 == static_cast<unsigned int>(matrix.rows() / N));
+    for (unsigned int ival = 0; ival < val2entry.size(); ++ival) {
+      const unsigned int entry = val2entry[ival];
+      matrix.valuePtr()[ival] = A.idx2block[entry / (N * N)]((entry % (N * N)) / N, entry % N);
+    }
+    solver.factorize(matrix);
+    return solver.info() == Eigen::Success;
+  }
+
+  /**
+   * solve the linear system using the factorization
+   * @param r right hand side
+   * @return solution
+   */
+  Vector solve(const Vector &r) const {
+    const unsigned int num_row = r.rows();
+    Eigen::VectorXd b(num_row * N);
+    for (unsigned int irow = 0; irow < num_row; ++irow) {
+      for (int i = 0; i < N; ++i) {
+        b(irow * N + i) = r(irow, i);
+      }
+    }
+    const Eigen::VectorXd x = solver.solve(b);
+    Vector res(num_row, N);
+    for (unsigned int irow = 0; irow < num_row; ++irow) {
+      for (int i = 0; i < N; ++i) {
+        res(irow, i) = x(irow * N + i);
+      }
+    }
+    return res;
+  }
+
+ private:
+  SparseMatrix matrix;
+  std::vector<unsigned int> val2entry; // index of entry in the block matrix for each value of `matrix`
+  Eigen::SimplicialLDLT<SparseMatrix, Eigen::Upper, Eigen::AMDOrdering<int> > solver;
+};
+
+} // namespace pba
+
+#endif //PBA_BLOCK_SPARSE_CHOLESKY_H_
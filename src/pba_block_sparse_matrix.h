@@ -5,19 +5,124 @@
 #ifndef PBA_BLOCK_SPARSE_MATRIX_H_
 #define PBA_BLOCK_SPARSE_MATRIX_H_
 
+#include <climits>
+#include <algorithm>
+
 namespace pba {
 
-template<int N>
+/**
+ * conjugate gradient method for a linear operator
+ * @tparam OPERATOR class with `multiply_vector(y, x)` that computes y = A x.
+ * Either a BlockSparseMatrix or a matrix-free operator.
+ * @param op linear operator
+ * @param r right hand side. residual is stored after the computation
+ * @param max_iteration maximum number of iterations
+ * @param tolerance ratio of the squared norm of the residual to stop the iteration
+ * @return solution
+ */
+template<typename OPERATOR, typename VECTOR>
+VECTOR solve_conjugate_gradient(
+    const OPERATOR &op,
+    VECTOR &r,
+    unsigned int max_iteration = 10,
+    double tolerance = 1.0e-4) {
+  VECTOR x = VECTOR::Zero(r.rows(), r.cols());
+  VECTOR p = r;
+  VECTOR Ap = p;
+  const double r_squared_norm_ini = r.squaredNorm();
+  double r_squared_norm_pre = r_squared_norm_ini;
+  for (unsigned int itr = 0; itr < max_iteration; ++itr) {
+    op.multiply_vector(Ap, p);
+    double alpha = r_squared_norm_pre / (p.cwiseProduct(Ap)).sum();
+    x += alpha * p;
+    r -= alpha * Ap;
+    const double r_squared_norm_pos = r.squaredNorm();
+    if (r_squared_norm_pos < r_squared_norm_ini * tolerance) { return x; }
+    double beta = r_squared_norm_pos / r_squared_norm_pre;
+    r_squared_norm_pre = r_squared_norm_pos;
+    p = r + beta * p;
+  }
+  return x;
+}
+
+/**
+ * sparse matrix of NxN blocks
+ * @tparam N size of the block
+ * @tparam REAL scalar type of the blocks (double or float)
+ */
+template<int N, typename REAL = double>
 class BlockSparseMatrix {
-  using Vector = Eigen::Matrix<double, Eigen::Dynamic, N>;
-  using BlockVector = Eigen::Vector<double, N>;
-  using BlockMatrix = Eigen::Matrix<double, N, N>;
+  using Vector = Eigen::Matrix<REAL, Eigen::Dynamic, N>;
+  using BlockVector = Eigen::Vector<REAL, N>;
  public:
-  void initialize(const Eigen::MatrixXi &elem2vtx, unsigned int num_vtx) {
-    auto[vtx2idx, idx2vtx] = pba::vertex_to_vertex(elem2vtx, num_vtx);
-    this->row2idx = vtx2idx;
-    this->idx2col = idx2vtx;
+  using BlockMatrix = Eigen::Matrix<REAL, N, N>;
+
+  /**
+   * set the sparsity pattern from the mesh connectivity
+   * @param elem2vtx element's vertex indices
+   * @param num_vtx number of vertices
+   * @param is_symmetric_ if true, only the diagonal and the upper blocks (i_row <= i_col) are stored
+   * @param num_slack_ number of empty slots reserved in each row for `add_connection` (see `reserve_slack`)
+   */
+  void initialize(
+      const Eigen::MatrixXi &elem2vtx,
+      unsigned int num_vtx,
+      bool is_symmetric_ = false,
+      unsigned int num_slack_ = 0) {
+    auto[vtx2idx, idx2vtx] = pba::vertex_to_vertex_parallel(elem2vtx, num_vtx);
+    this->is_symmetric = is_symmetric_;
+    if (is_symmetric) { // drop the lower blocks. the column indices are sorted in each row
+      this->row2idx.assign(1, 0);
+      this->idx2col.clear();
+      for (unsigned int irow = 0; irow < num_vtx; ++irow) {
+        for (unsigned int idx0 = vtx2idx[irow]; idx0 < vtx2idx[irow + 1]; ++idx0) {
+          if (idx2vtx[idx0] < irow) { continue; }
+          this->idx2col.push_back(idx2vtx[idx0]);
+        }
+        this->row2idx.push_back(this->idx2col.size());
+      }
+    } else {
+      this->row2idx = vtx2idx;
+      this->idx2col = idx2vtx;
+    }
     idx2block.resize(this->idx2col.size());
+    num_slack = 0;
+    num_removed = 0;
+    if (num_slack_ > 0) { reserve_slack(num_slack_); }
+  }
+
+  /**
+   * set the pattern to the full storage of the matrix A, which can be either full or symmetric storage.
+   * Only the pattern is copied. The empty slots of A are not copied.
+   * @return for each block, twice the index of the corresponding block in A, plus one if it is A's block transposed
+   */
+  std::vector<unsigned int> initialize_full_pattern(const BlockSparseMatrix &A) {
+    const unsigned int num_row = A.row2idx.size() - 1;
+    std::vector<std::vector<std::pair<unsigned int, unsigned int> > > row2cols(num_row);
+    for (unsigned int irow = 0; irow < num_row; ++irow) {
+      for (unsigned int idx0 = A.row2idx[irow]; idx0 < A.row2idx[irow + 1]; ++idx0) {
+        const unsigned int icol = A.idx2col[idx0];
+        if (icol == empty_slot) { continue; }
+        row2cols[irow].emplace_back(icol, idx0 * 2);
+        if (A.is_symmetric && icol != irow) { row2cols[icol].emplace_back(irow, idx0 * 2 + 1); }
+      }
+    }
+    std::vector<unsigned int> idx2src;
+    this->is_symmetric = false;
+    this->row2idx.assign(1, 0);
+    this->idx2col.clear();
+    for (unsigned int irow = 0; irow < num_row; ++irow) {
+      std::sort(row2cols[irow].begin(), row2cols[irow].end());
+      for (const auto &[icol, src]: row2cols[irow]) {
+        this->idx2col.push_back(icol);
+        idx2src.push_back(src);
+      }
+      this->row2idx.push_back(this->idx2col.size());
+    }
+    idx2block.resize(this->idx2col.size());
+    num_slack = 0;
+    num_removed = 0;
+    return idx2src;
   }
 
   void setZero() {
@@ -26,27 +131,128 @@ class BlockSparseMatrix {
     }
   }
 
+  /**
+   * reference to the block at (i_row, i_col).
+   * In the symmetric mode, only the upper blocks (i_row <= i_col) can be accessed.
+   */
   auto &coeff(unsigned int i_row, unsigned int i_col) {
+    return idx2block[block_index(i_row, i_col)];
+  }
+
+  /**
+   * index of the block at (i_row, i_col) in `idx2col` and `idx2block`
+   */
+  unsigned int block_index(unsigned int i_row, unsigned int i_col) const {
+    assert(!is_symmetric || i_row <= i_col);
     auto itr0 = idx2col.begin() + row2idx[i_row];
     auto itr1 = idx2col.begin() + row2idx[i_row + 1];
     auto itr2 = std::find(itr0, itr1, i_col);
     assert(itr2 != itr1);
-    unsigned int idx0 = std::distance(idx2col.begin(), itr2);
-    return idx2block[idx0];
+    return std::distance(idx2col.begin(), itr2);
+  }
+
+  /**
+   * indices of the blocks for all the pairs of the element's nodes, to merge the element's matrices without search.
+   * @param elem2vtx element's vertex indices
+   * @return for (i_elem, i_node, j_node), the index of the block (i_vtx, j_vtx) at i_elem * num_node^2 + i_node * num_node + j_node.
+   * In the symmetric storage, it is `empty_slot` for the lower blocks (i_vtx > j_vtx).
+   */
+  template<typename ELEM2VTX>
+  std::vector<unsigned int> element_to_block_index(const ELEM2VTX &elem2vtx) const {
+    const unsigned int num_node = elem2vtx.cols();
+    std::vector<unsigned int> elem2idx(elem2vtx.rows() * num_node * num_node);
+    for (unsigned int i_elem = 0; i_elem < elem2vtx.rows(); ++i_elem) {
+      for (unsigned int i_node = 0; i_node < num_node; ++i_node) {
+        for (unsigned int j_node = 0; j_node < num_node; ++j_node) {
+          const unsigned int i_vtx = elem2vtx(i_elem, i_node);
+          const unsigned int j_vtx = elem2vtx(i_elem, j_node);
+          const bool is_stored = !is_symmetric || i_vtx <= j_vtx;
+          elem2idx[(i_elem * num_node + i_node) * num_node + j_node] = is_stored ? block_index(i_vtx, j_vtx) : empty_slot;
+        }
+      }
+    }
+    return elem2idx;
+  }
+
+  /**
+   * add the connection between the vertices to the pattern (no-op if it already exists).
+   * The blocks (i_vtx, j_vtx) and (j_vtx, i_vtx) are added in the full storage, and only the upper one in the
+   * symmetric storage. A new block is zero and put in an empty slot of its row, so the cost does not depend on
+   * the size of the matrix. Only when the row has no empty slot, the storage is re-allocated with slack in
+   * every row (see `reserve_slack`). The column indices in a row are not sorted after this.
+   * The solvers made from this matrix (e.g., `BlockSparseCholesky`, `BlockSparseAmg`) need to be initialized again.
+   */
+  void add_connection(unsigned int i_vtx, unsigned int j_vtx) {
+    if (is_symmetric) {
+      add_block(std::min(i_vtx, j_vtx), std::max(i_vtx, j_vtx));
+      return;
+    }
+    add_block(i_vtx, j_vtx);
+    if (i_vtx != j_vtx) { add_block(j_vtx, i_vtx); }
+  }
+
+  /**
+   * remove the connection between the vertices from the pattern (no-op if it does not exist).
+   * The blocks are marked as empty slots and reused by `add_connection`. The storage is compacted when more than
+   * half of the slots are the removed ones, hence the cost of the compaction is amortized over the removals.
+   * The slack reserved by `reserve_slack` is not counted and is kept in the compaction.
+   */
+  void remove_connection(unsigned int i_vtx, unsigned int j_vtx) {
+    assert(i_vtx != j_vtx); // diagonal blocks are always kept
+    if (is_symmetric) {
+      remove_block(std::min(i_vtx, j_vtx), std::max(i_vtx, j_vtx));
+    } else {
+      remove_block(i_vtx, j_vtx);
+      remove_block(j_vtx, i_vtx);
+    }
+    if (num_removed * 2 > idx2col.size()) {
+      reallocate([this](unsigned int num_used, unsigned int) { return num_used + num_slack; });
+    }
+  }
+
+  /**
+   * re-allocate the storage such that each row has at least `num_slack_` empty slots. The values are kept.
+   * The slack is kept when the storage is compacted after the removals.
+   */
+  void reserve_slack(unsigned int num_slack_) {
+    num_slack = num_slack_;
+    reallocate([num_slack_](unsigned int num_used, unsigned int num_slot) {
+      return std::max(num_slot, num_used + num_slack_);
+    });
+  }
+
+  /**
+   * remove all the empty slots including the reserved slack. The values are kept.
+   */
+  void compact() {
+    num_slack = 0;
+    reallocate([](unsigned int num_used, unsigned int) { return num_used; });
+  }
+
+  template<typename VTX2ISFREE>
+  void set_is_free(
+      const VTX2ISFREE &vtx2isfree) {
+    set_is_free(vtx2isfree, idx2block.data());
   }
 
+  /**
+   * `set_is_free` for the blocks stored outside of this matrix with the same pattern (e.g., `BlockSparseMatrixBatch`)
+   */
+  template<typename VTX2ISFREE>
   void set_is_free(
-      const Vector &vtx2isfree) {
+      const VTX2ISFREE &vtx2isfree,
+      BlockMatrix *idx2block) const {
     unsigned int num_row = row2idx.size() - 1;
     for (unsigned int irow = 0; irow < num_row; ++irow) {
       for (unsigned int idx0 = row2idx[irow]; idx0 < row2idx[irow + 1]; ++idx0) {
         unsigned int icol = idx2col[idx0];
-        BlockMatrix dia_row = vtx2isfree.row(irow).asDiagonal();
-        BlockMatrix dia_col = vtx2isfree.row(icol).asDiagonal();
-        idx2block[idx0] = dia_col * idx2block[idx0] * dia_row;
+        if (icol == empty_slot) { continue; }
+        BlockMatrix dia_row = vtx2isfree.row(irow).template cast<REAL>().asDiagonal();
+        BlockMatrix dia_col = vtx2isfree.row(icol).template cast<REAL>().asDiagonal();
+        idx2block[idx0] = dia_row * idx2block[idx0] * dia_col;
         if (icol == irow) {
           for (int i = 0; i < N; ++i) {
-            idx2block[idx0](i, i) += 1.0 - vtx2isfree(irow, i);
+            idx2block[idx0](i, i) += static_cast<REAL>(1.0 - vtx2isfree(irow, i));
           }
         }
       }
@@ -54,41 +260,226 @@ class BlockSparseMatrix {
   }
   Vector solve_conjugate_gradient(
       Vector &r) const {
-    Vector x = Eigen::MatrixX3d::Zero(r.rows(), r.cols());
-    Vector p = r;
+    return pba::solve_conjugate_gradient(*this, r);
+  }
+
+  /**
+   * preconditioned conjugate gradient method
+   * @tparam PRECONDITIONER class with `apply(z, r)` that computes z = M^{-1} r
+   * @param r right hand side. residual is stored after the computation
+   * @param preconditioner preconditioner
+   * @param max_iteration maximum number of iterations
+   * @param tolerance ratio of the squared norm of the residual to stop the iteration
+   * @return solution and the number of iterations
+   */
+  template<typename PRECONDITIONER>
+  std::pair<Vector, unsigned int> solve_preconditioned_conjugate_gradient(
+      Vector &r,
+      const PRECONDITIONER &preconditioner,
+      unsigned int max_iteration = 100,
+      double tolerance = 1.0e-4) const {
+    Vector x = Vector::Zero(r.rows(), r.cols());
+    Vector z(r.rows(), r.cols());
+    preconditioner.apply(z, r);
+    Vector p = z;
     Vector Ap = p;
     const double r_squared_norm_ini = r.squaredNorm();
-    double r_squared_norm_pre = r_squared_norm_ini;
-    for (unsigned int itr = 0; itr < 10; ++itr) {
+    double rz_pre = r.cwiseProduct(z).sum();
+    for (unsigned int itr = 0; itr < max_iteration; ++itr) {
       this->multiply_vector(Ap, p);
-      double alpha = r_squared_norm_pre / (p.cwiseProduct(Ap)).sum();
+      double alpha = rz_pre / (p.cwiseProduct(Ap)).sum();
       x += alpha * p;
       r -= alpha * Ap;
-      const double r_squared_norm_pos = r.squaredNorm();
-      if (r_squared_norm_pos < r_squared_norm_ini * 1.0e-4) { return x; }
-      double beta = r_squared_norm_pos / r_squared_norm_pre;
-      r_squared_norm_pre = r_squared_norm_pos;
-      p = r + beta * p;
+      if (r.squaredNorm() < r_squared_norm_ini * tolerance) { return {x, itr + 1}; }
+      preconditioner.apply(z, r);
+      const double rz_pos = r.cwiseProduct(z).sum();
+      double beta = rz_pos / rz_pre;
+      rz_pre = rz_pos;
+      p = z + beta * p;
+    }
+    return {x, max_iteration};
+  }
+
+  /**
+   * conjugate gradient method with the mixed-precision iterative refinement.
+   * The blocks are stored and multiplied in `REAL` (e.g., float) in the inner iteration,
+   * while the dot products, the residual and the solution of the outer refinement are in double.
+   * @param r right hand side. residual is stored after the computation
+   * @param tolerance ratio of the squared norm of the residual to stop the refinement
+   * @param max_refinement maximum number of the outer refinement
+   * @param max_inner_iteration maximum number of iterations of the inner conjugate gradient method
+   * @return solution
+   */
+  Eigen::Matrix<double, Eigen::Dynamic, N> solve_conjugate_gradient_mixed_precision(
+      Eigen::Matrix<double, Eigen::Dynamic, N> &r,
+      double tolerance = 1.0e-8,
+      unsigned int max_refinement = 10,
+      unsigned int max_inner_iteration = 100) const {
+    using VectorD = Eigen::Matrix<double, Eigen::Dynamic, N>;
+    const VectorD b = r;
+    VectorD x = VectorD::Zero(r.rows(), r.cols());
+    VectorD Ax(r.rows(), r.cols());
+    const double r_squared_norm_ini = r.squaredNorm();
+    for (unsigned int iref = 0; iref < max_refinement; ++iref) {
+      if (r.squaredNorm() <= r_squared_norm_ini * tolerance) { break; }
+      // inner solve of the correction in the low precision
+      Vector r0 = r.template cast<REAL>();
+      Vector dx = Vector::Zero(r.rows(), r.cols());
+      Vector p = r0;
+      Vector Ap = p;
+      const double r0_squared_norm_ini = dot(r0, r0);
+      double r0_squared_norm_pre = r0_squared_norm_ini;
+      for (unsigned int itr = 0; itr < max_inner_iteration; ++itr) {
+        this->multiply_vector(Ap, p);
+        const double alpha = r0_squared_norm_pre / dot(p, Ap);
+        dx += static_cast<REAL>(alpha) * p;
+        r0 -= static_cast<REAL>(alpha) * Ap;
+        const double r0_squared_norm_pos = dot(r0, r0);
+        if (r0_squared_norm_pos < r0_squared_norm_ini * 1.0e-6) { break; }
+        const double beta = r0_squared_norm_pos / r0_squared_norm_pre;
+        r0_squared_norm_pre = r0_squared_norm_pos;
+        p = r0 + static_cast<REAL>(beta) * p;
+      }
+      // update the solution and the residual in double
+      x += dx.template cast<double>();
+      this->multiply_vector(Ax, x);
+      r = b - Ax;
     }
     return x;
   }
- private:
-  void multiply_vector(Vector &y,
-                       const Vector &x) const {
+
+  /**
+   * y = A x. The vectors can have a different scalar type from the blocks'.
+   * The blocks are converted to the vector's scalar type on the fly.
+   */
+  template<typename VECTOR>
+  void multiply_vector(VECTOR &y,
+                       const VECTOR &x) const {
+    multiply_vector(y, x, idx2block.data());
+  }
+
+  /**
+   * y = A x for the blocks stored outside of this matrix with the same pattern (e.g., `BlockSparseMatrixBatch`)
+   */
+  template<typename VECTOR>
+  void multiply_vector(VECTOR &y,
+                       const VECTOR &x,
+                       const BlockMatrix *idx2block) const {
+    using SCALAR = typename VECTOR::Scalar;
+    using BlockVectorX = Eigen::Vector<SCALAR, N>;
     unsigned int num_row = row2idx.size() - 1;
     y.setZero();
+    if (is_symmetric) { // each upper block is applied together with its transpose
+      for (unsigned int irow = 0; irow < num_row; ++irow) {
+        const BlockVectorX x_row = x.row(irow);
+        BlockVectorX y_row = BlockVectorX::Zero();
+        for (unsigned int idx0 = row2idx[irow]; idx0 < row2idx[irow + 1]; ++idx0) {
+          unsigned int icol = idx2col[idx0];
+          if (icol == empty_slot) { continue; }
+          BlockVectorX x0 = x.row(icol);
+          y_row += idx2block[idx0].template cast<SCALAR>() * x0;
+          if (icol == irow) { continue; }
+          y.row(icol) += (idx2block[idx0].template cast<SCALAR>().transpose() * x_row).transpose();
+        }
+        y.row(irow) += y_row.transpose();
+      }
+      return;
+    }
     for (unsigned int irow = 0; irow < num_row; ++irow) {
       for (unsigned int idx0 = row2idx[irow]; idx0 < row2idx[irow + 1]; ++idx0) {
         unsigned int icol = idx2col[idx0];
-        BlockVector x0 = x.row(icol);
-        y.row(irow) += idx2block[idx0] * x0;
+        if (icol == empty_slot) { continue; }
+        BlockVectorX x0 = x.row(icol);
+        y.row(irow) += idx2block[idx0].template cast<SCALAR>() * x0;
+      }
+    }
+  }
+
+  /**
+   * dot product accumulated in double regardless of the vectors' scalar type
+   */
+  template<typename VECTOR>
+  static double dot(const VECTOR &a, const VECTOR &b) {
+    assert(a.size() == b.size());
+    double sum = 0.0;
+    for (unsigned int i = 0; i < a.size(); ++i) {
+      sum += static_cast<double>(a.data()[i]) * static_cast<double>(b.data()[i]);
+    }
+    return sum;
+  }
+ private:
+  void add_block(unsigned int i_row, unsigned int i_col) {
+    auto itr0 = idx2col.begin() + row2idx[i_row];
+    auto itr1 = idx2col.begin() + row2idx[i_row + 1];
+    if (std::find(itr0, itr1, i_col) != itr1) { return; }
+    if (std::find(itr0, itr1, empty_slot) == itr1) {
+      // no slack in this row. every row gets the slack of a quarter of its used slots (at least two),
+      // and this row is grown twice as large
+      reallocate([](unsigned int num_used, unsigned int num_slot) {
+        return std::max(num_slot, num_used + std::max(2u, num_used / 4));
+      }, i_row);
+      itr0 = idx2col.begin() + row2idx[i_row];
+      itr1 = idx2col.begin() + row2idx[i_row + 1];
+    }
+    const auto itr2 = std::find(itr0, itr1, empty_slot);
+    assert(itr2 != itr1);
+    *itr2 = i_col;
+    idx2block[std::distance(idx2col.begin(), itr2)].setZero();
+    if (num_removed > 0) { num_removed -= 1; } // the empty slots in excess of the slack decrease
+  }
+
+  void remove_block(unsigned int i_row, unsigned int i_col) {
+    auto itr0 = idx2col.begin() + row2idx[i_row];
+    auto itr1 = idx2col.begin() + row2idx[i_row + 1];
+    const auto itr2 = std::find(itr0, itr1, i_col);
+    if (itr2 == itr1) { return; }
+    *itr2 = empty_slot;
+    idx2block[std::distance(idx2col.begin(), itr2)].setZero();
+    num_removed += 1;
+  }
+
+  /**
+   * move the used slots to new storage
+   * @param slot_size function of (number of used slots, current number of slots) returning the new number of slots
+   * @param i_row_grow row whose number of slots is doubled additionally
+   */
+  template<typename FUNC>
+  void reallocate(FUNC &&slot_size, unsigned int i_row_grow = UINT_MAX) {
+    const unsigned int num_row = row2idx.size() - 1;
+    std::vector<unsigned int> row2idx_new(num_row + 1, 0);
+    for (unsigned int irow = 0; irow < num_row; ++irow) {
+      const unsigned int num_slot = row2idx[irow + 1] - row2idx[irow];
+      const unsigned int num_used = num_slot - static_cast<unsigned int>(std::count(
+          idx2col.begin() + row2idx[irow], idx2col.begin() + row2idx[irow + 1], empty_slot));
+      unsigned int num_slot_new = slot_size(num_used, num_slot);
+      if (irow == i_row_grow) { num_slot_new = std::max(num_slot_new, num_slot * 2); }
+      row2idx_new[irow + 1] = row2idx_new[irow] + num_slot_new;
+    }
+    std::vector<unsigned int> idx2col_new(row2idx_new[num_row], empty_slot);
+    std::vector<BlockMatrix> idx2block_new(row2idx_new[num_row], BlockMatrix::Zero());
+    for (unsigned int irow = 0; irow < num_row; ++irow) {
+      unsigned int idx1 = row2idx_new[irow];
+      for (unsigned int idx0 = row2idx[irow]; idx0 < row2idx[irow + 1]; ++idx0) {
+        if (idx2col[idx0] == empty_slot) { continue; }
+        idx2col_new[idx1] = idx2col[idx0];
+        idx2block_new[idx1] = idx2block[idx0];
+        ++idx1;
       }
     }
+    num_removed = 0;
+    row2idx = std::move(row2idx_new);
+    idx2col = std::move(idx2col_new);
+    idx2block = std::move(idx2block_new);
   }
+
  public:
+  static constexpr unsigned int empty_slot = UINT_MAX; // column index of the empty slot
   std::vector<unsigned int> row2idx;
-  std::vector<unsigned int> idx2col;
+  std::vector<unsigned int> idx2col; // `empty_slot` if the slot is not used
   std::vector<BlockMatrix> idx2block;
+  bool is_symmetric = false;
+  unsigned int num_slack = 0; // number of the empty slots reserved in each row by `reserve_slack`
+  unsigned int num_removed = 0; // number of the slots emptied by `remove_connection` since the last re-allocation
 };
 
 } // namespace pba
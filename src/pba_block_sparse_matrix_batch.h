@@ -0,0 +1,99 @@
+//
+// many block sparse matrices sharing the same sparsity pattern
+//
+
+#ifndef PBA_BLOCK_SPARSE_MATRIX_BATCH_H_
+#define PBA_BLOCK_SPARSE_MATRIX_BATCH_H_
+
+#include <vector>
+#include <cassert>
+#include <Eigen/Dense>
+
+#include "pba_util_eigen.h"
+#include "pba_block_sparse_matrix.h"
+
+namespace pba {
+
+/**
+ * Values of `num_instance` matrices that share one sparsity pattern (e.g., the same mesh with different
+ * material parameters). The pattern is stored only once and the blocks of all the instances are stored in
+ * one contiguous array, instance by instance. Each instance is accessed independently, so the instances
+ * can be assembled and solved in parallel.
+ * @tparam N size of the block
+ * @tparam REAL scalar type of the blocks
+ */
+template<int N, typename REAL = double>
+class BlockSparseMatrixBatch {
+  using BlockMatrix = typename BlockSparseMatrix<N, REAL>::BlockMatrix;
+ public:
+  /**
+   * linear operator of one instance for `pba::solve_conjugate_gradient`
+   */
+  class Instance {
+   public:
+    Instance(const BlockSparseMatrixBatch &batch, unsigned int i_instance)
+        : batch(batch), i_instance(i_instance) {}
+
+    template<typename VECTOR>
+    void multiply_vector(VECTOR &y, const VECTOR &x) const {
+      batch.pattern.multiply_vector(y, x, batch.blocks(i_instance));
+    }
+
+   private:
+    const BlockSparseMatrixBatch &batch;
+    const unsigned int i_instance;
+  };
+
+  /**
+   * copy the pattern of the matrix and allocate the blocks for the instances. The values of the matrix are not copied.
+   */
+  void initialize(
+      const BlockSparseMatrix<N, REAL> &A,
+      unsigned int num_instance_) {
+    pattern.row2idx = A.row2idx;
+    pattern.idx2col = A.idx2col;
+    pattern.is_symmetric = A.is_symmetric;
+    pattern.num_slack = A.num_slack;
+    pattern.num_removed = A.num_removed;
+    pattern.idx2block.clear();
+    num_instance = num_instance_;
+    idx2block.resize(static_cast<size_t>(num_instance) * num_block());
+  }
+
+  [[nodiscard]] unsigned int num_block() const { return pattern.idx2col.size(); }
+
+  BlockMatrix *blocks(unsigned int i_instance) {
+    assert(i_instance < num_instance);
+    return idx2block.data() + static_cast<size_t>(i_instance) * num_block();
+  }
+
+  [[nodiscard]] const BlockMatrix *blocks(unsigned int i_instance) const {
+    assert(i_instance < num_instance);
+    return idx2block.data() + static_cast<size_t>(i_instance) * num_block();
+  }
+
+  [[nodiscard]] Instance instance(unsigned int i_instance) const {
+    return Instance(*this, i_instance);
+  }
+
+  void setZero(unsigned int i_instance) {
+    BlockMatrix *idx2block_ins = blocks(i_instance);
+    for (unsigned int idx0 = 0; idx0 < num_block(); ++idx0) {
+      idx2block_ins[idx0].setZero();
+    }
+  }
+
+  template<typename VTX2ISFREE>
+  void set_is_free(unsigned int i_instance, const VTX2ISFREE &vtx2isfree) {
+    pattern.set_is_free(vtx2isfree, blocks(i_instance));
+  }
+
+ public:
+  BlockSparseMatrix<N, REAL> pattern; // only the pattern is used
+  std::vector<BlockMatrix> idx2block; // blocks of the instance `i` start at `i * num_block()`
+  unsigned int num_instance = 0;
+};
+
+} // namespace pba
+
+#endif //PBA_BLOCK_SPARSE_MATRIX_BATCH_H_
@@ -0,0 +1,159 @@
+//
+// block sparse matrix with 3x3 blocks in a layout for the 4-lane SIMD
+//
+
+#ifndef PBA_BLOCK_SPARSE_MATRIX_PADDED_H_
+#define PBA_BLOCK_SPARSE_MATRIX_PADDED_H_
+
+#include <vector>
+#include <cassert>
+#include <Eigen/Dense>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "pba_util_eigen.h"
+#include "pba_block_sparse_matrix.h"
+
+namespace pba {
+
+/**
+ * Copy of a `BlockSparseMatrix<3>` in the layout for the SIMD.
+ * The vectors are row-major and padded to 4 lanes. Each 3x3 block is stored column-major without padding,
+ * and each column is read as 4 lanes whose last lane overlaps the next column.
+ * Hence a block-vector product is three broadcast & multiply-add of 4 lanes, while the memory traffic of the
+ * blocks stays the same as the unpadded 9 values. The overlapping lane is cleared before storing the result.
+ * The AVX2 kernel is chosen at compile time when `__AVX2__` is defined (e.g., `-mavx2 -mfma`).
+ */
+class PaddedBlockSparseMatrix3 {
+ public:
+  using Vector = Eigen::Matrix<double, Eigen::Dynamic, 4, Eigen::RowMajor>; // the 4th lane is zero
+
+  /**
+   * set the pattern in the full storage from the matrix in either storage
+   */
+  void initialize(const BlockSparseMatrix<3> &A) {
+    BlockSparseMatrix<3> full;
+    idx2src = full.initialize_full_pattern(A);
+    row2idx = std::move(full.row2idx);
+    idx2col = std::move(full.idx2col);
+    idx2val.assign(idx2col.size() * 9 + 1, 0.); // one extra value for the 4-lane read of the last column
+  }
+
+  /**
+   * copy the values from the matrix given to `initialize`
+   */
+  void set_value(const BlockSparseMatrix<3> &A) {
+    assert(idx2src.size() == idx2col.size());
+    for (unsigned int idx0 = 0; idx0 < idx2col.size(); ++idx0) {
+      const Eigen::Matrix3d &block = A.idx2block[idx2src[idx0] / 2];
+      const bool is_transpose = idx2src[idx0] % 2 == 1;
+      double *val = idx2val.data() + idx0 * 9;
+      for (unsigned int icol = 0; icol < 3; ++icol) {
+        for (unsigned int irow = 0; irow < 3; ++irow) {
+          val[icol * 3 + irow] = is_transpose ? block(icol, irow) : block(irow, icol);
+        }
+      }
+    }
+  }
+
+  void multiply_vector(
+      Vector &y,
+      const Vector &x) const {
+    const unsigned int num_row = row2idx.size() - 1;
+    assert(static_cast<unsigned int>(x.rows()) == num_row);
+    y.resize(num_row, 4);
+    const double *xp = x.data();
+    double *yp = y.data();
+#if defined(__AVX2__)
+    for (unsigned int irow = 0; irow < num_row; ++irow) {
+      __m256d y0 = _mm256_setzero_pd();
+      __m256d y1 = _mm256_setzero_pd();
+      __m256d y2 = _mm256_setzero_pd();
+      for (unsigned int idx0 = row2idx[irow]; idx0 < row2idx[irow + 1]; ++idx0) {
+        const double *val = idx2val.data() + idx0 * 9;
+        const double *x0 = xp + idx2col[idx0] * 4;
+#if defined(__FMA__)
+        y0 = _mm256_fmadd_pd(_mm256_loadu_pd(val + 0), _mm256_broadcast_sd(x0 + 0), y0);
+        y1 = _mm256_fmadd_pd(_mm256_loadu_pd(val + 3), _mm256_broadcast_sd(x0 + 1), y1);
+        y2 = _mm256_fmadd_pd(_mm256_loadu_pd(val + 6), _mm256_broadcast_sd(x0 + 2), y2);
+#else
+        y0 = _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(val + 0), _mm256_broadcast_sd(x0 + 0)), y0);
+        y1 = _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(val + 3), _mm256_broadcast_sd(x0 + 1)), y1);
+        y2 = _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(val + 6), _mm256_broadcast_sd(x0 + 2)), y2);
+#endif
+      }
+      const __m256d y3 = _mm256_add_pd(_mm256_add_pd(y0, y1), y2);
+      _mm256_storeu_pd(yp + irow * 4, _mm256_blend_pd(y3, _mm256_setzero_pd(), 0b1000));
+    }
+#else
+    for (unsigned int irow = 0; irow < num_row; ++irow) {
+      double y0[3] = {0., 0., 0.};
+      for (unsigned int idx0 = row2idx[irow]; idx0 < row2idx[irow + 1]; ++idx0) {
+        const double *val = idx2val.data() + idx0 * 9;
+        const double *x0 = xp + idx2col[idx0] * 4;
+        for (unsigned int i = 0; i < 3; ++i) {
+          y0[i] += val[i] * x0[0] + val[3 + i] * x0[1] + val[6 + i] * x0[2];
+        }
+      }
+      for (unsigned int i = 0; i < 3; ++i) { yp[irow * 4 + i] = y0[i]; }
+      yp[irow * 4 + 3] = 0.;
+    }
+#endif
+  }
+
+  /**
+   * conjugate gradient method with the same stopping rule as `BlockSparseMatrix::solve_conjugate_gradient`
+   * @param r right hand side. residual is stored after the computation
+   */
+  Vector solve_conjugate_gradient(
+      Vector &r,
+      unsigned int max_iteration = 10,
+      double tolerance = 1.0e-4) const {
+    Vector x = Vector::Zero(r.rows(), 4);
+    Vector p = r;
+    Vector Ap = p;
+    const double r_squared_norm_ini = r.squaredNorm();
+    double r_squared_norm_pre = r_squared_norm_ini;
+    for (unsigned int itr = 0; itr < max_iteration; ++itr) {
+      this->multiply_vector(Ap, p);
+      double alpha = r_squared_norm_pre / (p.cwiseProduct(Ap)).sum();
+      x += alpha * p;
+      r -= alpha * Ap;
+      const double r_squared_norm_pos = r.squaredNorm();
+      if (r_squared_norm_pos < r_squared_norm_ini * tolerance) { return x; }
+      double beta = r_squared_norm_pos / r_squared_norm_pre;
+      r_squared_norm_pre = r_squared_norm_pos;
+      p = r + beta * p;
+    }
+    return x;
+  }
+
+  /**
+   * convert an (n x 3) matrix to the padded layout
+   */
+  template<typename VTX2VAL>
+  static Vector to_padded(const VTX2VAL &vtx2val) {
+    Vector res = Vector::Zero(vtx2val.rows(), 4);
+    res.leftCols<3>() = vtx2val.template cast<double>();
+    return res;
+  }
+
+  /**
+   * convert a vector in the padded layout to an (n x 3) matrix
+   */
+  static Eigen::MatrixX3d from_padded(const Vector &vtx2val) {
+    return vtx2val.leftCols<3>();
+  }
+
+ public:
+  std::vector<unsigned int> row2idx;
+  std::vector<unsigned int> idx2col;
+  std::vector<double> idx2val; // 9 values (column-major) per block, plus one value at the end
+ private:
+  std::vector<unsigned int> idx2src; // see `BlockSparseMatrix::initialize_full_pattern`
+};
+
+} // namespace pba
+
+#endif //PBA_BLOCK_SPARSE_MATRIX_PADDED_H_
@@ -0,0 +1,1111 @@
+//
+// solvers of the Laplace equation with the Dirichlet boundary condition on a square grid
+//
+
+#ifndef PBA_GRID_LAPLACE_H_
+#define PBA_GRID_LAPLACE_H_
+
+#include <vector>
+#include <array>
+#include <cstddef>
+#include <cassert>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <complex>
+
+#include "pba_parallel.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846264338327950288
+#endif
+
+namespace pba {
+
+/**
+ * Gauss-Seidel method in the red-black (checkerboard) order for the Dirichlet's energy on a grid.
+ * The values are stored row by row (i.e., the index of the cell (ix, iy) is iy * grid_size + ix).
+ * All the cells of one color depend only on the cells of the other color, so each color is updated
+ * in parallel over the rows. The fixed cells are given as a blend mask (1 for free and 0 for fixed)
+ * so that the inner loop over a row has no branch and can be vectorized.
+ * A free cell on the border of the grid is the average of its neighbors inside the grid.
+ */
+class GridLaplaceRedBlack {
+ public:
+  template<typename VTX2ISFIX>
+  void initialize(
+      unsigned int grid_size_,
+      const VTX2ISFIX &vtx2isfix) {
+    grid_size = grid_size_;
+    assert(vtx2isfix.size() == grid_size * grid_size);
+    vtx2free.resize(grid_size * grid_size);
+    for (unsigned int idx = 0; idx < grid_size * grid_size; ++idx) {
+      vtx2free[idx] = vtx2isfix[idx] ? 0.f : 1.f;
+    }
+  }
+
+  /**
+   * one sweep: the red cells ((ix + iy) is even) are updated, then the black cells
+   * @param num_thread number of threads. The default number is used if zero
+   */
+  void sweep(
+      std::vector<float> &vtx2val,
+      unsigned int num_thread = 0) const {
+    sweep(vtx2val.data(), nullptr, num_thread);
+  }
+
+  /**
+   * one sweep for the Poisson's equation L u = f, where (L u)_i is the sum of (u_i - u_j) over the neighbors j
+   * @param vtx2val u
+   * @param vtx2rhs f. zero if nullptr
+   * @param num_thread number of threads. The default number is used if zero
+   */
+  void sweep(
+      float *vtx2val,
+      const float *vtx2rhs,
+      unsigned int num_thread = 0) const {
+    for (unsigned int i_color = 0; i_color < 2; ++i_color) {
+      pba::parallel_for(grid_size, [&](unsigned int iy_begin, unsigned int iy_end) {
+        for (unsigned int iy = iy_begin; iy < iy_end; ++iy) {
+          sweep_row(vtx2val, vtx2rhs, iy, i_color);
+        }
+      }, num_thread);
+    }
+  }
+
+  /**
+   * `num_sweep` sweeps with the temporal cache blocking. The result is identical to calling `sweep` `num_sweep` times.
+   * The half-sweep h (the color is h % 2) of the row iy needs the rows iy-1, iy and iy+1 after the half-sweep h-1,
+   * so the half-sweeps are applied in a wavefront where the half-sweep h lags one row behind the half-sweep h-1.
+   * Only about 2 * num_sweep rows are touched at a time, so they stay in the cache during all the sweeps.
+   * For the parallelization, the rows are split into blocks. The wavefront of each block shrinks by one row
+   * per half-sweep at the block's ends (trapezoids), then the triangles left between the blocks are filled.
+   * @param num_thread number of threads. The default number is used if zero
+   */
+  void sweep_temporal_blocking(
+      std::vector<float> &vtx2val,
+      unsigned int num_sweep,
+      unsigned int num_thread = 0) const {
+    assert(vtx2val.size() == grid_size * grid_size);
+    const unsigned int n = grid_size;
+    const unsigned int num_half = num_sweep * 2;
+    if (num_half == 0) { return; }
+    if (num_thread == 0) { num_thread = pba::num_thread_default(); }
+    const unsigned int num_block = std::max(1u, std::min(num_thread, n / (num_half * 2)));
+    auto block_begin = [&](unsigned int i_block) {
+      return static_cast<unsigned int>(static_cast<size_t>(n) * i_block / num_block);
+    };
+    float *val = vtx2val.data();
+    // trapezoid of each block
+    pba::parallel_for(num_block, [&](unsigned int i_block_begin, unsigned int i_block_end) {
+      for (unsigned int i_block = i_block_begin; i_block < i_block_end; ++i_block) {
+        const unsigned int iy_begin = block_begin(i_block);
+        const unsigned int iy_end = block_begin(i_block + 1);
+        for (unsigned int iwave = iy_begin; iwave < iy_end + num_half; ++iwave) {
+          for (unsigned int ihalf = 0; ihalf < num_half && ihalf <= iwave; ++ihalf) {
+            const unsigned int iy = iwave - ihalf;
+            const unsigned int iy_lo = (iy_begin == 0) ? 0 : iy_begin + ihalf;
+            const unsigned int iy_hi = (iy_end == n) ? n : iy_end - ihalf;
+            if (iy < iy_lo || iy >= iy_hi) { continue; }
+            sweep_row(val, nullptr, iy, ihalf % 2);
+          }
+        }
+      }
+    }, num_block);
+    // triangles between the blocks
+    pba::parallel_for(num_block - 1, [&](unsigned int i_block_begin, unsigned int i_block_end) {
+      for (unsigned int i_block = i_block_begin; i_block < i_block_end; ++i_block) {
+        const unsigned int iy_boundary = block_begin(i_block + 1);
+        for (unsigned int ihalf = 1; ihalf < num_half; ++ihalf) {
+          for (unsigned int iy = iy_boundary - ihalf; iy < iy_boundary + ihalf; ++iy) {
+            sweep_row(val, nullptr, iy, ihalf % 2);
+          }
+        }
+      }
+    }, num_block);
+  }
+
+  /**
+   * update the cells of the color in the row `iy`. Only the cells of the other color are read.
+   */
+  void sweep_row(
+      float *vtx2val,
+      const float *vtx2rhs,
+      unsigned int iy,
+      unsigned int i_color) const {
+    const unsigned int n = grid_size;
+    float *val = vtx2val + iy * n;
+    const float *free = vtx2free.data() + iy * n;
+    const unsigned int ix_start = (iy + i_color) % 2; // the first cell of this color in the row
+    if (iy == 0 || iy == n - 1 || n < 3) {
+      for (unsigned int ix = ix_start; ix < n; ix += 2) {
+        val[ix] += omega * free[ix] * (average_neighbors(vtx2val, vtx2rhs, ix, iy) - val[ix]);
+      }
+      return;
+    }
+    const float *val_down = val - n;
+    const float *val_up = val + n;
+    if (ix_start == 0) { val[0] += omega * free[0] * (average_neighbors(vtx2val, vtx2rhs, 0, iy) - val[0]); }
+    // interior cells without branch. The stride-2 loop has no dependency between the iterations.
+    // The index is size_t so that the compiler can vectorize the loop without the 32-bit wrap-around
+    if (vtx2rhs) {
+      const float *rhs = vtx2rhs + iy * n;
+      for (size_t ix = 2 - ix_start; ix < n - 1; ix += 2) {
+        const float avg = 0.25f * (val[ix - 1] + val[ix + 1] + val_down[ix] + val_up[ix] + rhs[ix]);
+        val[ix] += omega * free[ix] * (avg - val[ix]);
+      }
+    } else {
+      for (size_t ix = 2 - ix_start; ix < n - 1; ix += 2) {
+        const float avg = 0.25f * (val[ix - 1] + val[ix + 1] + val_down[ix] + val_up[ix]);
+        val[ix] += omega * free[ix] * (avg - val[ix]);
+      }
+    }
+    if ((n - 1) % 2 == ix_start) {
+      val[n - 1] += omega * free[n - 1] * (average_neighbors(vtx2val, vtx2rhs, n - 1, iy) - val[n - 1]);
+    }
+  }
+
+  /**
+   * value of a cell satisfying L u = f given its neighbors inside the grid
+   */
+  [[nodiscard]] float average_neighbors(
+      const float *vtx2val,
+      const float *vtx2rhs,
+      unsigned int ix,
+      unsigned int iy) const {
+    const unsigned int n = grid_size;
+    float sum = vtx2rhs ? vtx2rhs[iy * n + ix] : 0.f;
+    unsigned int num = 0;
+    if (ix > 0) { sum += vtx2val[iy * n + ix - 1]; ++num; }
+    if (ix < n - 1) { sum += vtx2val[iy * n + ix + 1]; ++num; }
+    if (iy > 0) { sum += vtx2val[(iy - 1) * n + ix]; ++num; }
+    if (iy < n - 1) { sum += vtx2val[(iy + 1) * n + ix]; ++num; }
+    return sum / static_cast<float>(num);
+  }
+
+  /**
+   * residual f - L u of the free cells (zero for the fixed cells)
+   * @param vtx2rhs f. zero if nullptr
+   */
+  void residual(
+      float *vtx2res,
+      const float *vtx2val,
+      const float *vtx2rhs,
+      unsigned int num_thread = 0) const {
+    const unsigned int n = grid_size;
+    pba::parallel_for(n, [&](unsigned int iy_begin, unsigned int iy_end) {
+      for (unsigned int iy = iy_begin; iy < iy_end; ++iy) {
+        for (unsigned int ix = 0; ix < n; ++ix) {
+          const unsigned int idx = iy * n + ix;
+          float sum = vtx2rhs ? vtx2rhs[idx] : 0.f;
+          unsigned int num = 0;
+          if (ix > 0) { sum += vtx2val[idx - 1]; ++num; }
+          if (ix < n - 1) { sum += vtx2val[idx + 1]; ++num; }
+          if (iy > 0) { sum += vtx2val[idx - n]; ++num; }
+          if (iy < n - 1) { sum += vtx2val[idx + n]; ++num; }
+          vtx2res[idx] = vtx2free[idx] * (sum - static_cast<float>(num) * vtx2val[idx]);
+        }
+      }
+    }, num_thread);
+  }
+
+  /**
+   * norm of the residual of the Laplace's equation of the free cells
+   */
+  [[nodiscard]] double residual_norm(
+      const std::vector<float> &vtx2val) const {
+    std::vector<float> vtx2res(vtx2val.size());
+    residual(vtx2res.data(), vtx2val.data(), nullptr);
+    double sum = 0.;
+    for (float res: vtx2res) { sum += static_cast<double>(res) * res; }
+    return std::sqrt(sum);
+  }
+
+  /**
+   * spectral radius of the Jacobi method's iteration matrix.
+   * If all the border cells are fixed, it is the bound cos(pi / (n - 1)) of the grid without the other fixed cells,
+   * which is exact for that grid. Fixing more cells only decreases the spectral radius since the iteration matrix
+   * is non-negative, and the overestimation is on the safe side for the SOR and the Chebyshev acceleration.
+   * Otherwise, it is estimated by the Lanczos method on the symmetrized iteration matrix D^{-1/2} (D - L) D^{-1/2},
+   * whose largest eigenvalue converges in O(sqrt(condition number)) iterations. Its spectrum is symmetric on a grid,
+   * so the largest eigenvalue is the spectral radius.
+   * @param max_iteration maximum number of the Lanczos iterations
+   */
+  [[nodiscard]] double estimate_jacobi_spectral_radius(
+      unsigned int max_iteration = 10000) const {
+    const unsigned int n = grid_size;
+    if (n < 3) { return 0.; }
+    bool is_border_fixed = true;
+    for (unsigned int i = 0; i < n; ++i) {
+      for (unsigned int idx: {i, i * n, i * n + n - 1, (n - 1) * n + i}) {
+        if (vtx2free[idx] != 0.f) { is_border_fixed = false; }
+      }
+    }
+    if (is_border_fixed) { return std::cos(M_PI / static_cast<double>(n - 1)); }
+    // Lanczos method without the re-orthogonalization, which is enough for the largest eigenvalue
+    std::vector<double> vtx2isqrtdeg(n * n);
+    for (unsigned int iy = 0; iy < n; ++iy) {
+      for (unsigned int ix = 0; ix < n; ++ix) {
+        const unsigned int num = (ix > 0) + (ix < n - 1) + (iy > 0) + (iy < n - 1);
+        vtx2isqrtdeg[iy * n + ix] = 1. / std::sqrt(static_cast<double>(num));
+      }
+    }
+    std::vector<double> tmp(n * n);
+    auto multiply = [&](std::vector<double> &y, const std::vector<double> &x) {
+      for (unsigned int idx = 0; idx < tmp.size(); ++idx) { tmp[idx] = x[idx] * vtx2isqrtdeg[idx]; }
+      for (unsigned int iy = 0; iy < n; ++iy) {
+        for (unsigned int ix = 0; ix < n; ++ix) {
+          const unsigned int idx = iy * n + ix;
+          double sum = 0.;
+          if (ix > 0) { sum += tmp[idx - 1]; }
+          if (ix < n - 1) { sum += tmp[idx + 1]; }
+          if (iy > 0) { sum += tmp[idx - n]; }
+          if (iy < n - 1) { sum += tmp[idx + n]; }
+          y[idx] = vtx2free[idx] * sum * vtx2isqrtdeg[idx];
+        }
+      }
+    };
+    auto dot = [](const std::vector<double> &a, const std::vector<double> &b) {
+      double sum = 0.;
+      for (unsigned int i = 0; i < a.size(); ++i) { sum += a[i] * b[i]; }
+      return sum;
+    };
+    std::vector<double> q(n * n), q_pre(n * n, 0.), w(n * n);
+    {
+      std::mt19937 rand(0);
+      std::uniform_real_distribution<double> dist01(0., 1.);
+      for (unsigned int idx = 0; idx < q.size(); ++idx) { q[idx] = vtx2free[idx] * dist01(rand); }
+      const double norm = std::sqrt(dot(q, q));
+      if (norm == 0.) { return 0.; }
+      for (double &v: q) { v /= norm; }
+    }
+    std::vector<double> alpha, beta; // the tri-diagonal matrix
+    double rho = 0.;
+    for (unsigned int itr = 0; itr < max_iteration; ++itr) {
+      multiply(w, q);
+      const double b_pre = beta.empty() ? 0. : beta.back();
+      for (unsigned int idx = 0; idx < w.size(); ++idx) { w[idx] -= b_pre * q_pre[idx]; }
+      alpha.push_back(dot(w, q));
+      for (unsigned int idx = 0; idx < w.size(); ++idx) { w[idx] -= alpha.back() * q[idx]; }
+      beta.push_back(std::sqrt(dot(w, w)));
+      if (itr % 10 == 9 || beta.back() <= 1.0e-12) { // the Ritz value is checked every ten iterations
+        const double rho_new = largest_eigenvalue_tridiagonal(alpha, beta);
+        // omega only depends on 1 - rho, so its relative accuracy is what matters
+        if (rho_new - rho < 1.0e-3 * (1. - rho_new) || beta.back() <= 1.0e-12) { return rho_new; }
+        rho = rho_new;
+      }
+      q_pre.swap(q);
+      for (unsigned int idx = 0; idx < w.size(); ++idx) { q[idx] = w[idx] / beta.back(); }
+    }
+    return rho;
+  }
+
+  /**
+   * set the relaxation factor of the successive over-relaxation (SOR) optimal for the Jacobi's spectral radius rho:
+   * omega = 2 / (1 + sqrt(1 - rho^2))
+   */
+  void set_optimal_relaxation_factor() {
+    const double rho = estimate_jacobi_spectral_radius();
+    omega = static_cast<float>(2. / (1. + std::sqrt(std::max(0., 1. - rho * rho))));
+  }
+
+  /**
+   * largest eigenvalue of the symmetric tri-diagonal matrix by the bisection with the Sturm sequence
+   * @param alpha diagonal
+   * @param beta off-diagonal. beta[i] is between i and i + 1 (the last one is not used)
+   */
+  static double largest_eigenvalue_tridiagonal(
+      const std::vector<double> &alpha,
+      const std::vector<double> &beta) {
+    const unsigned int m = alpha.size();
+    double lower = alpha[0], upper = alpha[0];
+    for (unsigned int i = 0; i < m; ++i) { // Gershgorin's bound
+      const double r = (i > 0 ? std::abs(beta[i - 1]) : 0.) + (i + 1 < m ? std::abs(beta[i]) : 0.);
+      lower = std::min(lower, alpha[i] - r);
+      upper = std::max(upper, alpha[i] + r);
+    }
+    auto num_eigenvalue_above = [&](double x) { // the negative pivots of T - x I count the eigenvalues below x
+      unsigned int num_below = 0;
+      double d = 1.;
+      for (unsigned int i = 0; i < m; ++i) {
+        const double b2 = i > 0 ? beta[i - 1] * beta[i - 1] : 0.;
+        d = alpha[i] - x - (i > 0 ? b2 / d : 0.);
+        if (d == 0.) { d = 1.0e-300; }
+        if (d < 0.) { ++num_below; }
+      }
+      return m - num_below;
+    };
+    for (unsigned int itr = 0; itr < 100 && upper - lower > 1.0e-14; ++itr) {
+      const double mid = 0.5 * (lower + upper);
+      if (num_eigenvalue_above(mid) > 0) { lower = mid; } else { upper = mid; }
+    }
+    return upper;
+  }
+
+ public:
+  unsigned int grid_size = 0;
+  std::vector<float> vtx2free; // 1 for the free cells and 0 for the fixed cells
+  float omega = 1.f; // relaxation factor. 1 for the Gauss-Seidel method and (1, 2) for the SOR
+};
+
+/**
+ * Jacobi method accelerated by the Chebyshev semi-iteration for the Dirichlet's energy on a grid.
+ * With the Jacobi update J(u), the iteration is u_{k+1} = w_{k+1} (J(u_k) - u_{k-1}) + u_{k-1} where
+ * w_1 = 1, w_2 = 1 / (1 - rho^2 / 2), w_{k+1} = 1 / (1 - rho^2 w_k / 4) and rho is the Jacobi's spectral radius.
+ * Each cell is updated independently from the previous two iterates, so all the cells are updated in parallel.
+ */
+class GridLaplaceChebyshevJacobi {
+ public:
+  template<typename VTX2ISFIX>
+  void initialize(
+      unsigned int grid_size,
+      const VTX2ISFIX &vtx2isfix) {
+    grid.initialize(grid_size, vtx2isfix);
+    rho = grid.estimate_jacobi_spectral_radius();
+    restart();
+  }
+
+  /**
+   * restart the semi-iteration (e.g., when the values are modified outside)
+   */
+  void restart() {
+    num_iteration = 0;
+    omega = 1.;
+    vtx2val_pre.clear();
+  }
+
+  void iterate(
+      std::vector<float> &vtx2val,
+      unsigned int num_thread = 0) {
+    const unsigned int n = grid.grid_size;
+    assert(vtx2val.size() == n * n);
+    if (num_iteration == 0) {
+      vtx2val_pre = vtx2val;
+      omega = 1.;
+    } else if (num_iteration == 1) {
+      omega = 1. / (1. - rho * rho * 0.5);
+    } else {
+      omega = 1. / (1. - rho * rho * omega * 0.25);
+    }
+    vtx2val_new.resize(n * n);
+    const float w = static_cast<float>(omega);
+    pba::parallel_for(n, [&](unsigned int iy_begin, unsigned int iy_end) {
+      for (unsigned int iy = iy_begin; iy < iy_end; ++iy) {
+        const float *val = vtx2val.data() + iy * n;
+        const float *val_pre = vtx2val_pre.data() + iy * n;
+        const float *free = grid.vtx2free.data() + iy * n;
+        float *val_new = vtx2val_new.data() + iy * n;
+        auto update_border = [&](unsigned int ix) {
+          const float jac = val[ix] + free[ix] * (grid.average_neighbors(vtx2val.data(), nullptr, ix, iy) - val[ix]);
+          val_new[ix] = w * (jac - val_pre[ix]) + val_pre[ix];
+        };
+        if (iy == 0 || iy == n - 1 || n < 3) {
+          for (unsigned int ix = 0; ix < n; ++ix) { update_border(ix); }
+          continue;
+        }
+        update_border(0);
+        update_border(n - 1);
+        const float *val_down = val - n;
+        const float *val_up = val + n;
+        for (size_t ix = 1; ix < n - 1; ++ix) { // no branch and no dependency between iterations
+          const float avg = 0.25f * (val[ix - 1] + val[ix + 1] + val_down[ix] + val_up[ix]);
+          const float jac = val[ix] + free[ix] * (avg - val[ix]);
+          val_new[ix] = w * (jac - val_pre[ix]) + val_pre[ix];
+        }
+      }
+    }, num_thread);
+    vtx2val_pre.swap(vtx2val);
+    vtx2val.swap(vtx2val_new);
+    ++num_iteration;
+  }
+
+  [[nodiscard]] double residual_norm(
+      const std::vector<float> &vtx2val) const {
+    return grid.residual_norm(vtx2val);
+  }
+
+ public:
+  double rho = 0.; // spectral radius of the Jacobi method
+ private:
+  GridLaplaceRedBlack grid; // the fixed cells and the helper functions
+  unsigned int num_iteration = 0;
+  double omega = 1.;
+  std::vector<float> vtx2val_pre;
+  std::vector<float> vtx2val_new;
+};
+
+/**
+ * Dirichlet's energy of the grid (sum of the squared differences of the adjacent cells over two)
+ */
+inline double dirichlet_energy_on_grid(
+    const std::vector<float> &vtx2val,
+    unsigned int grid_size) {
+  const unsigned int n = grid_size;
+  double w = 0.;
+  for (unsigned int iy = 0; iy < n; ++iy) {
+    for (unsigned int ix = 0; ix < n; ++ix) {
+      const double val = vtx2val[iy * n + ix];
+      if (iy + 1 < n) { w += 0.5 * (val - vtx2val[(iy + 1) * n + ix]) * (val - vtx2val[(iy + 1) * n + ix]); }
+      if (ix + 1 < n) { w += 0.5 * (val - vtx2val[iy * n + ix + 1]) * (val - vtx2val[iy * n + ix + 1]); }
+    }
+  }
+  return w;
+}
+
+/**
+ * Geometric multigrid method with the correction scheme for the Dirichlet's energy on a grid.
+ * The cell (ix, iy) of a coarse grid (size n/2+1) is on the cell (2 ix, 2 iy) of the fine grid. The correction is
+ * prolongated by the bilinear interpolation P to the free cells, the residual is restricted by P^T (i.e., the full
+ * weighting scaled by four), and the coarse operator is the Galerkin product P^T A P, which is a 3x3 stencil.
+ * Hence the coarse problem sees the fixed cells of the fine grid exactly, and the number of cycles does not grow
+ * with the grid size. A coarse cell is fixed if none of the fine cells it interpolates to is free.
+ * The red-black Gauss-Seidel method is used as the smoother on the finest level and the Gauss-Seidel method
+ * in the four-color order (the parities of ix and iy) on the coarse levels.
+ */
+class GridLaplaceMultigrid {
+  struct Level {
+    unsigned int grid_size = 0;
+    std::vector<std::array<float, 9> > vtx2stencil; // coefficient of the cell (ix + dx, iy + dy) at (dy + 1) * 3 + (dx + 1)
+    std::vector<float> vtx2free; // 1 for the free cells and 0 for the fixed cells
+    std::vector<float> vtx2val; // correction (unused on the finest level)
+    std::vector<float> vtx2rhs; // right hand side (unused on the finest level)
+    std::vector<float> vtx2res; // residual
+  };
+ public:
+  /**
+   * @param grid_size size of the finest grid
+   * @param vtx2isfix fixed flags of the finest grid
+   * @param grid_size_coarsest the grid is coarsened until its size is not larger than this
+   */
+  void initialize(
+      unsigned int grid_size,
+      const std::vector<bool> &vtx2isfix,
+      unsigned int grid_size_coarsest = 5) {
+    smoother.initialize(grid_size, vtx2isfix);
+    levels.clear();
+    Level &finest = levels.emplace_back();
+    finest.grid_size = grid_size;
+    finest.vtx2free = smoother.vtx2free;
+    finest.vtx2res.resize(grid_size * grid_size);
+    // five-point stencil of the finest grid restricted to the free cells. It is only used to build the coarse levels
+    std::vector<std::array<float, 9> > vtx2stencil(grid_size * grid_size);
+    for (unsigned int iy = 0; iy < grid_size; ++iy) {
+      for (unsigned int ix = 0; ix < grid_size; ++ix) {
+        const unsigned int idx = iy * grid_size + ix;
+        std::array<float, 9> &a = vtx2stencil[idx];
+        a.fill(0.f);
+        if (vtx2isfix[idx]) { continue; }
+        const int dxy[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+        for (const auto &d: dxy) {
+          const int ix1 = static_cast<int>(ix) + d[0];
+          const int iy1 = static_cast<int>(iy) + d[1];
+          if (ix1 < 0 || iy1 < 0 || ix1 >= static_cast<int>(grid_size) || iy1 >= static_cast<int>(grid_size)) { continue; }
+          a[4] += 1.f;
+          if (!vtx2isfix[iy1 * grid_size + ix1]) { a[(d[1] + 1) * 3 + (d[0] + 1)] = -1.f; }
+        }
+      }
+    }
+    while (grid_size > grid_size_coarsest) {
+      Level &coarse = levels.emplace_back();
+      coarse.grid_size = grid_size / 2 + 1;
+      const unsigned int nc = coarse.grid_size;
+      coarse.vtx2stencil = galerkin_coarse_stencil(vtx2stencil, levels[levels.size() - 2].vtx2free, grid_size);
+      coarse.vtx2free.resize(nc * nc);
+      for (unsigned int idx = 0; idx < nc * nc; ++idx) {
+        coarse.vtx2free[idx] = coarse.vtx2stencil[idx][4] > 0.f ? 1.f : 0.f;
+      }
+      coarse.vtx2val.resize(nc * nc);
+      coarse.vtx2rhs.resize(nc * nc);
+      coarse.vtx2res.resize(nc * nc);
+      vtx2stencil = coarse.vtx2stencil;
+      grid_size = nc;
+    }
+  }
+
+  /**
+   * one multigrid cycle
+   * @param num_smooth number of the pre- and post-smoothing sweeps
+   * @param cycle_index number of the visits to the next coarser level. 1 for the V-cycle and 2 for the W-cycle.
+   */
+  void cycle(
+      std::vector<float> &vtx2val,
+      unsigned int num_smooth = 2,
+      unsigned int cycle_index = 2) {
+    assert(vtx2val.size() == levels[0].vtx2res.size());
+    cycle(0, vtx2val.data(), nullptr, num_smooth, cycle_index);
+  }
+
+  /**
+   * W-cycles until the relative decrease of the Dirichlet's energy becomes smaller than the tolerance
+   * @return number of the cycles
+   */
+  unsigned int solve(
+      std::vector<float> &vtx2val,
+      double tolerance = 1.0e-6,
+      unsigned int max_cycle = 100) {
+    const unsigned int grid_size = levels[0].grid_size;
+    double energy_pre = dirichlet_energy_on_grid(vtx2val, grid_size);
+    for (unsigned int itr = 0; itr < max_cycle; ++itr) {
+      cycle(vtx2val);
+      const double energy = dirichlet_energy_on_grid(vtx2val, grid_size);
+      if (energy_pre - energy <= tolerance * energy) { return itr + 1; }
+      energy_pre = energy;
+    }
+    return max_cycle;
+  }
+
+  [[nodiscard]] unsigned int num_level() const { return levels.size(); }
+
+ private:
+  void cycle(
+      unsigned int i_level,
+      float *vtx2val,
+      const float *vtx2rhs,
+      unsigned int num_smooth,
+      unsigned int cycle_index) {
+    Level &fine = levels[i_level];
+    auto smooth = [&]() {
+      if (i_level == 0) {
+        smoother.sweep(vtx2val, vtx2rhs);
+      } else {
+        sweep_stencil(fine, vtx2val, vtx2rhs);
+      }
+    };
+    if (i_level + 1 == levels.size()) { // coarsest grid: smooth until convergence
+      for (unsigned int itr = 0; itr < fine.grid_size * fine.grid_size; ++itr) { smooth(); }
+      return;
+    }
+    for (unsigned int itr = 0; itr < num_smooth; ++itr) { smooth(); }
+    if (i_level == 0) {
+      smoother.residual(fine.vtx2res.data(), vtx2val, vtx2rhs);
+    } else {
+      residual_stencil(fine.vtx2res.data(), fine, vtx2val, vtx2rhs);
+    }
+    Level &coarse = levels[i_level + 1];
+    restrict_full_weighting(coarse.vtx2rhs, fine.vtx2res, fine.grid_size, coarse);
+    std::fill(coarse.vtx2val.begin(), coarse.vtx2val.end(), 0.f);
+    for (unsigned int i_visit = 0; i_visit < cycle_index; ++i_visit) {
+      cycle(i_level + 1, coarse.vtx2val.data(), coarse.vtx2rhs.data(), num_smooth, cycle_index);
+    }
+    prolongate_bilinear(vtx2val, coarse.vtx2val, fine);
+    for (unsigned int itr = 0; itr < num_smooth; ++itr) { smooth(); }
+  }
+
+  /**
+   * coarse stencil P^T A P from the fine stencil A, where P is the bilinear interpolation to the free fine cells
+   */
+  static std::vector<std::array<float, 9> > galerkin_coarse_stencil(
+      const std::vector<std::array<float, 9> > &vtx2stencil_fine,
+      const std::vector<float> &vtx2free_fine,
+      unsigned int grid_size_fine) {
+    const int nf = static_cast<int>(grid_size_fine);
+    const int nc = nf / 2 + 1;
+    std::vector<std::array<float, 9> > vtx2stencil_coarse(nc * nc);
+    for (auto &a: vtx2stencil_coarse) { a.fill(0.f); }
+    // coarse cells and weights of P interpolating to the fine cell
+    auto interpolation = [](int i, int (&i2c)[2], float (&i2w)[2]) -> int {
+      i2c[0] = i / 2;
+      if (i % 2 == 0) {
+        i2w[0] = 1.f;
+        return 1;
+      }
+      i2c[1] = i / 2 + 1;
+      i2w[0] = i2w[1] = 0.5f;
+      return 2;
+    };
+    for (int iyf = 0; iyf < nf; ++iyf) {
+      for (int ixf = 0; ixf < nf; ++ixf) {
+        if (vtx2free_fine[iyf * nf + ixf] == 0.f) { continue; }
+        const std::array<float, 9> &a = vtx2stencil_fine[iyf * nf + ixf];
+        int ixc[2], iyc[2];
+        float wx[2], wy[2];
+        const int nx = interpolation(ixf, ixc, wx);
+        const int ny = interpolation(iyf, iyc, wy);
+        for (int k = 0; k < 9; ++k) {
+          if (a[k] == 0.f) { continue; }
+          const int jxf = ixf + k % 3 - 1;
+          const int jyf = iyf + k / 3 - 1;
+          int jxc[2], jyc[2];
+          float vx[2], vy[2];
+          const int mx = interpolation(jxf, jxc, vx);
+          const int my = interpolation(jyf, jyc, vy);
+          for (int iy = 0; iy < ny; ++iy) {
+            for (int ix = 0; ix < nx; ++ix) {
+              std::array<float, 9> &ac = vtx2stencil_coarse[iyc[iy] * nc + ixc[ix]];
+              for (int jy = 0; jy < my; ++jy) {
+                for (int jx = 0; jx < mx; ++jx) {
+                  const int kc = (jyc[jy] - iyc[iy] + 1) * 3 + (jxc[jx] - ixc[ix] + 1);
+                  ac[kc] += wx[ix] * wy[iy] * a[k] * vx[jx] * vy[jy];
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+    return vtx2stencil_coarse;
+  }
+
+  /**
+   * sum of the stencil's off-diagonal terms applied to the neighbors of the cell (ix, iy)
+   */
+  static float sum_off_diagonal(
+      const Level &level,
+      const float *vtx2val,
+      unsigned int ix,
+      unsigned int iy) {
+    const unsigned int n = level.grid_size;
+    const std::array<float, 9> &a = level.vtx2stencil[iy * n + ix];
+    const float *v = vtx2val + iy * n + ix;
+    if (ix > 0 && iy > 0 && ix + 1 < n && iy + 1 < n) { // interior cell without branch
+      const std::ptrdiff_t m = n;
+      return a[0] * v[-m - 1] + a[1] * v[-m] + a[2] * v[-m + 1] + a[3] * v[-1]
+          + a[5] * v[1] + a[6] * v[m - 1] + a[7] * v[m] + a[8] * v[m + 1];
+    }
+    float sum = 0.f;
+    for (unsigned int k = 0; k < 9; ++k) {
+      if (k == 4 || a[k] == 0.f) { continue; } // the coefficients outside of the grid are zero
+      sum += a[k] * vtx2val[(iy + k / 3 - 1) * n + (ix + k % 3 - 1)];
+    }
+    return sum;
+  }
+
+  /**
+   * the small coarse levels are processed by one thread since the cost of launching the threads dominates
+   */
+  static unsigned int num_thread_level(const Level &level) {
+    return level.grid_size < 128 ? 1 : 0;
+  }
+
+  /**
+   * Gauss-Seidel sweep on a coarse level. The cells of the same parities of ix and iy are not adjacent
+   * in the 3x3 stencil, so each of the four colors is updated in parallel
+   */
+  static void sweep_stencil(
+      const Level &level,
+      float *vtx2val,
+      const float *vtx2rhs) {
+    const unsigned int n = level.grid_size;
+    for (unsigned int i_color = 0; i_color < 4; ++i_color) {
+      const unsigned int num_row = (n + 1 - i_color / 2) / 2;
+      pba::parallel_for(num_row, [&](unsigned int i_begin, unsigned int i_end) {
+        for (unsigned int i = i_begin; i < i_end; ++i) {
+          const unsigned int iy = i * 2 + i_color / 2;
+          for (unsigned int ix = i_color % 2; ix < n; ix += 2) {
+            const unsigned int idx = iy * n + ix;
+            if (level.vtx2free[idx] == 0.f) { continue; }
+            vtx2val[idx] = (vtx2rhs[idx] - sum_off_diagonal(level, vtx2val, ix, iy)) / level.vtx2stencil[idx][4];
+          }
+        }
+      }, num_thread_level(level));
+    }
+  }
+
+  /**
+   * residual f - A u of the free cells on a coarse level
+   */
+  static void residual_stencil(
+      float *vtx2res,
+      const Level &level,
+      const float *vtx2val,
+      const float *vtx2rhs) {
+    const unsigned int n = level.grid_size;
+    pba::parallel_for(n, [&](unsigned int iy_begin, unsigned int iy_end) {
+      for (unsigned int iy = iy_begin; iy < iy_end; ++iy) {
+        for (unsigned int ix = 0; ix < n; ++ix) {
+          const unsigned int idx = iy * n + ix;
+          const float au = level.vtx2stencil[idx][4] * vtx2val[idx] + sum_off_diagonal(level, vtx2val, ix, iy);
+          vtx2res[idx] = level.vtx2free[idx] * (vtx2rhs[idx] - au);
+        }
+      }
+    }, num_thread_level(level));
+  }
+
+  /**
+   * coarse right hand side P^T r from the fine residual r (the full weighting scaled by four)
+   */
+  static void restrict_full_weighting(
+      std::vector<float> &vtx2rhs_coarse,
+      const std::vector<float> &vtx2res_fine,
+      unsigned int grid_size_fine,
+      const Level &coarse) {
+    const unsigned int nf = grid_size_fine;
+    const unsigned int nc = coarse.grid_size;
+    pba::parallel_for(nc, [&](unsigned int iy_begin, unsigned int iy_end) {
+      for (unsigned int iyc = iy_begin; iyc < iy_end; ++iyc) {
+        for (unsigned int ixc = 0; ixc < nc; ++ixc) {
+          float sum = 0.f;
+          for (int dy = -1; dy <= 1; ++dy) {
+            for (int dx = -1; dx <= 1; ++dx) {
+              const int ixf = static_cast<int>(2 * ixc) + dx;
+              const int iyf = static_cast<int>(2 * iyc) + dy;
+              if (ixf < 0 || iyf < 0 || ixf >= static_cast<int>(nf) || iyf >= static_cast<int>(nf)) { continue; }
+              const float w = (dx == 0 ? 0.5f : 0.25f) * (dy == 0 ? 0.5f : 0.25f);
+              sum += w * vtx2res_fine[iyf * nf + ixf];
+            }
+          }
+          vtx2rhs_coarse[iyc * nc + ixc] = 4.f * coarse.vtx2free[iyc * nc + ixc] * sum;
+        }
+      }
+    }, num_thread_level(coarse));
+  }
+
+  /**
+   * add the bilinear interpolation of the coarse correction to the free cells of the fine grid
+   */
+  static void prolongate_bilinear(
+      float *vtx2val_fine,
+      const std::vector<float> &vtx2val_coarse,
+      const Level &fine) {
+    const unsigned int nf = fine.grid_size;
+    const unsigned int nc = nf / 2 + 1;
+    pba::parallel_for(nf, [&](unsigned int iy_begin, unsigned int iy_end) {
+      for (unsigned int iyf = iy_begin; iyf < iy_end; ++iyf) {
+        const unsigned int iyc0 = iyf / 2;
+        const unsigned int iyc1 = (iyf % 2 == 0) ? iyc0 : iyc0 + 1;
+        for (unsigned int ixf = 0; ixf < nf; ++ixf) {
+          const unsigned int ixc0 = ixf / 2;
+          const unsigned int ixc1 = (ixf % 2 == 0) ? ixc0 : ixc0 + 1;
+          const float val = 0.25f * (
+              vtx2val_coarse[iyc0 * nc + ixc0] + vtx2val_coarse[iyc0 * nc + ixc1] +
+              vtx2val_coarse[iyc1 * nc + ixc0] + vtx2val_coarse[iyc1 * nc + ixc1]);
+          vtx2val_fine[iyf * nf + ixf] += fine.vtx2free[iyf * nf + ixf] * val;
+        }
+      }
+    }, num_thread_level(fine));
+  }
+
+ private:
+  GridLaplaceRedBlack smoother; // smoother on the finest level
+  std::vector<Level> levels;
+};
+
+/**
+ * discrete sine transform of type I: y_k = sum_{j=1}^{m} x_j sin(pi j k / (m + 1)) for k = 1, ..., m.
+ * Applying it twice gives the input multiplied by (m + 1) / 2.
+ * It is computed with the radix-2 fast Fourier transform of the odd extension of length 2(m + 1),
+ * so m + 1 needs to be a power of two.
+ */
+class DiscreteSineTransform {
+  using Complex = std::complex<double>;
+ public:
+  void initialize(unsigned int m_) {
+    m = m_;
+    num_fft = 2 * (m + 1);
+    assert((num_fft & (num_fft - 1)) == 0);
+    twiddle.resize(num_fft / 2);
+    for (unsigned int k = 0; k < num_fft / 2; ++k) { twiddle[k] = std::polar(1.0, -2.0 * M_PI * k / num_fft); }
+  }
+
+  /**
+   * transform two real sequences of length m at once (in place)
+   * @param buffer work space of size `buffer_size()`
+   */
+  void transform_pair(
+      double *a,
+      double *b,
+      Complex *buffer) const {
+    // odd extension of (a + i b). The transform of a real odd sequence is imaginary, so both are recovered
+    Complex *z = buffer;
+    z[0] = Complex(0., 0.);
+    z[m + 1] = Complex(0., 0.);
+    for (unsigned int j = 1; j <= m; ++j) {
+      z[j] = Complex(a[j - 1], b[j - 1]);
+      z[num_fft - j] = -z[j];
+    }
+    fft_radix2(z, num_fft, twiddle);
+    for (unsigned int k = 1; k <= m; ++k) { // Z_k = -2i (y_a)_k + 2 (y_b)_k
+      a[k - 1] = -0.5 * z[k].imag();
+      b[k - 1] = 0.5 * z[k].real();
+    }
+  }
+
+  [[nodiscard]] unsigned int buffer_size() const { return num_fft; }
+
+  /**
+   * in-place radix-2 FFT (X_k = sum_j x_j exp(-2 pi i j k / n))
+   * @param twiddle exp(-2 pi i k / n) for k = 0, ..., n/2 - 1
+   */
+  static void fft_radix2(
+      Complex *x,
+      unsigned int n,
+      const std::vector<Complex> &twiddle) {
+    for (unsigned int i = 1, j = 0; i < n; ++i) { // bit reversal
+      unsigned int bit = n >> 1;
+      for (; j & bit; bit >>= 1) { j ^= bit; }
+      j ^= bit;
+      if (i < j) { std::swap(x[i], x[j]); }
+    }
+    for (unsigned int len = 2; len <= n; len <<= 1) {
+      const unsigned int step = n / len;
+      for (unsigned int i = 0; i < n; i += len) {
+        for (unsigned int k = 0; k < len / 2; ++k) {
+          const Complex t = twiddle[k * step] * x[i + k + len / 2];
+          x[i + k + len / 2] = x[i + k] - t;
+          x[i + k] += t;
+        }
+      }
+    }
+  }
+
+ private:
+  unsigned int m = 0;
+  unsigned int num_fft = 0; // 2 (m + 1)
+  std::vector<Complex> twiddle;
+};
+
+/**
+ * Direct solver of the Laplace's equation on a grid with the fast Poisson solver.
+ * The border of the grid needs to be fixed. The 5-point Laplacian with the zero Dirichlet boundary on a square of
+ * m x m cells is diagonalized by the two-dimensional discrete sine transform, so it is solved in O(m^2 log m).
+ * The square is the interior cells of the grid extended to the top and right such that m + 1 is a power of two.
+ * The fixed cells inside the square (including the grid's border on the top and right if extended) are handled
+ * by the capacitance matrix method: point sources c are put on the fixed cells adjacent to the free cells such that
+ * the solution takes the fixed values there. The capacitance system (P^T A^{-1} P) c = g - P^T A^{-1} f is
+ * symmetric positive definite and solved by the conjugate gradient method, where each iteration is one fast solve.
+ */
+class GridLaplaceFastPoisson {
+ public:
+  void initialize(
+      unsigned int grid_size_,
+      const std::vector<bool> &vtx2isfix) {
+    grid_size = grid_size_;
+    const unsigned int n = grid_size;
+    assert(n >= 3 && vtx2isfix.size() == n * n);
+    for (unsigned int i = 0; i < n; ++i) {
+      assert(vtx2isfix[i] && vtx2isfix[(n - 1) * n + i] && vtx2isfix[i * n] && vtx2isfix[i * n + n - 1]);
+    }
+    m = 1;
+    while (m + 1 < n - 1) { m = m * 2 + 1; }
+    dst.initialize(m);
+    idx2eigen.resize(m * m);
+    const double scale = 2.0 / (m + 1); // normalization of the DST applied twice in each direction
+    for (unsigned int ky = 0; ky < m; ++ky) {
+      for (unsigned int kx = 0; kx < m; ++kx) {
+        const double eigen = 4.0 - 2.0 * std::cos(M_PI * (kx + 1) / (m + 1)) - 2.0 * std::cos(M_PI * (ky + 1) / (m + 1));
+        idx2eigen[ky * m + kx] = scale * scale / eigen;
+      }
+    }
+    // fixed cells inside the square adjacent to the free cells
+    vtx2isfix_ = vtx2isfix;
+    fix2vtx.clear();
+    for (unsigned int iy = 1; iy < n; ++iy) {
+      for (unsigned int ix = 1; ix < n; ++ix) {
+        const unsigned int idx = iy * n + ix;
+        if (!is_inside_square(ix, iy) || !vtx2isfix[idx]) { continue; }
+        if ((ix + 1 < n && !vtx2isfix[idx + 1]) || !vtx2isfix[idx - 1] ||
+            (iy + 1 < n && !vtx2isfix[idx + n]) || !vtx2isfix[idx - n]) {
+          fix2vtx.push_back(idx);
+        }
+      }
+    }
+  }
+
+  /**
+   * solve the Laplace's equation for the free cells. The values of the fixed cells are the boundary condition
+   * @param tolerance ratio of the residual's norm of the capacitance system to stop the iteration
+   * @return number of the conjugate gradient iterations
+   */
+  unsigned int solve(
+      std::vector<float> &vtx2val,
+      double tolerance = 1.0e-10,
+      unsigned int max_iteration = 1000) const {
+    const unsigned int n = grid_size;
+    assert(vtx2val.size() == n * n);
+    // right hand side from the fixed values on the boundary of the square
+    std::vector<double> rhs(m * m, 0.);
+    for (unsigned int iy = 1; iy < n - 1; ++iy) {
+      for (unsigned int ix = 1; ix < n - 1; ++ix) {
+        if (vtx2isfix_[iy * n + ix]) { continue; }
+        const unsigned int ixy[4][2] = {{ix - 1, iy}, {ix + 1, iy}, {ix, iy - 1}, {ix, iy + 1}};
+        for (const auto &[jx, jy]: ixy) {
+          if (!is_inside_square(jx, jy)) { rhs[to_square(ix, iy)] += vtx2val[jy * n + jx]; }
+        }
+      }
+    }
+    // u0 = A^{-1} f and the right hand side of the capacitance system
+    std::vector<double> sol = rhs;
+    solve_poisson(sol);
+    const unsigned int num_fix = fix2vtx.size();
+    std::vector<double> c(num_fix, 0.), r(num_fix), p(num_fix), Ap(num_fix);
+    for (unsigned int ifix = 0; ifix < num_fix; ++ifix) {
+      r[ifix] = vtx2val[fix2vtx[ifix]] - sol[to_square(fix2vtx[ifix])];
+    }
+    std::vector<double> grid(m * m);
+    auto apply_capacitance = [&](std::vector<double> &y, const std::vector<double> &x) {
+      std::fill(grid.begin(), grid.end(), 0.);
+      for (unsigned int ifix = 0; ifix < num_fix; ++ifix) { grid[to_square(fix2vtx[ifix])] = x[ifix]; }
+      solve_poisson(grid);
+      for (unsigned int ifix = 0; ifix < num_fix; ++ifix) { y[ifix] = grid[to_square(fix2vtx[ifix])]; }
+    };
+    auto dot = [](const std::vector<double> &a, const std::vector<double> &b) {
+      double sum = 0.;
+      for (unsigned int i = 0; i < a.size(); ++i) { sum += a[i] * b[i]; }
+      return sum;
+    };
+    p = r;
+    const double r_squared_norm_ini = dot(r, r);
+    double r_squared_norm_pre = r_squared_norm_ini;
+    unsigned int itr = 0;
+    for (; itr < max_iteration && r_squared_norm_pre > r_squared_norm_ini * tolerance * tolerance; ++itr) {
+      apply_capacitance(Ap, p);
+      const double alpha = r_squared_norm_pre / dot(p, Ap);
+      for (unsigned int i = 0; i < num_fix; ++i) {
+        c[i] += alpha * p[i];
+        r[i] -= alpha * Ap[i];
+      }
+      const double r_squared_norm_pos = dot(r, r);
+      const double beta = r_squared_norm_pos / r_squared_norm_pre;
+      r_squared_norm_pre = r_squared_norm_pos;
+      for (unsigned int i = 0; i < num_fix; ++i) { p[i] = r[i] + beta * p[i]; }
+    }
+    // u = A^{-1} (f + P c)
+    for (unsigned int ifix = 0; ifix < num_fix; ++ifix) { rhs[to_square(fix2vtx[ifix])] += c[ifix]; }
+    solve_poisson(rhs);
+    for (unsigned int iy = 1; iy < n - 1; ++iy) {
+      for (unsigned int ix = 1; ix < n - 1; ++ix) {
+        if (vtx2isfix_[iy * n + ix]) { continue; }
+        vtx2val[iy * n + ix] = static_cast<float>(rhs[to_square(ix, iy)]);
+      }
+    }
+    return itr;
+  }
+
+  /**
+   * solve A u = f for the m x m cells of the square with zero on its boundary (in place)
+   */
+  void solve_poisson(std::vector<double> &sqr2val) const {
+    assert(sqr2val.size() == m * m);
+    transform_rows(sqr2val);
+    transpose(sqr2val);
+    transform_rows(sqr2val);
+    for (unsigned int idx = 0; idx < m * m; ++idx) { sqr2val[idx] *= idx2eigen[idx]; } // eigenvalues are symmetric
+    transform_rows(sqr2val);
+    transpose(sqr2val);
+    transform_rows(sqr2val);
+  }
+
+ private:
+  [[nodiscard]] bool is_inside_square(unsigned int ix, unsigned int iy) const {
+    return ix >= 1 && iy >= 1 && ix <= m && iy <= m;
+  }
+
+  [[nodiscard]] unsigned int to_square(unsigned int ix, unsigned int iy) const {
+    return (iy - 1) * m + (ix - 1);
+  }
+
+  [[nodiscard]] unsigned int to_square(unsigned int idx) const {
+    return to_square(idx % grid_size, idx / grid_size);
+  }
+
+  void transform_rows(std::vector<double> &sqr2val) const {
+    const unsigned int num_pair = (m + 1) / 2;
+    pba::parallel_for(num_pair, [&](unsigned int ipair_begin, unsigned int ipair_end) {
+      std::vector<std::complex<double> > buffer(dst.buffer_size());
+      std::vector<double> row_dummy(m, 0.);
+      for (unsigned int ipair = ipair_begin; ipair < ipair_end; ++ipair) {
+        double *row0 = sqr2val.data() + (ipair * 2) * m;
+        double *row1 = (ipair * 2 + 1 < m) ? sqr2val.data() + (ipair * 2 + 1) * m : row_dummy.data();
+        dst.transform_pair(row0, row1, buffer.data());
+      }
+    });
+  }
+
+  void transpose(std::vector<double> &a) const {
+    for (unsigned int i = 0; i < m; ++i) {
+      for (unsigned int j = i + 1; j < m; ++j) { std::swap(a[i * m + j], a[j * m + i]); }
+    }
+  }
+
+ public:
+  unsigned int grid_size = 0;
+  unsigned int m = 0; // size of the square for the discrete sine transform (m + 1 is a power of two)
+  std::vector<unsigned int> fix2vtx; // fixed cells adjacent to the free cells, where the point sources are put
+ private:
+  DiscreteSineTransform dst;
+  std::vector<double> idx2eigen; // inverse of the eigenvalues of the Laplacian with the normalization of the DST
+  std::vector<bool> vtx2isfix_;
+};
+
+/**
+ * Gauss-Seidel method only for the cells that are still changing, for the Dirichlet's energy on a grid.
+ * A worklist keeps the free cells whose local residual may be above the threshold. When a cell is updated,
+ * its neighbors are pushed to the worklist because their residuals change. The Dirichlet's energy is updated
+ * incrementally from the change of each cell, so the cost of a sweep is proportional to the size of the worklist.
+ */
+class GridLaplaceActiveSet {
+ public:
+  /**
+   * @param vtx2val values used to compute the initial energy
+   * @param threshold_ a cell is updated if the absolute value of its residual is larger than this
+   */
+  void initialize(
+      unsigned int grid_size_,
+      const std::vector<bool> &vtx2isfix_,
+      const std::vector<float> &vtx2val,
+      float threshold_ = 1.0e-5f) {
+    grid_size = grid_size_;
+    vtx2isfix = vtx2isfix_;
+    threshold = threshold_;
+    assert(vtx2isfix.size() == grid_size * grid_size && vtx2val.size() == grid_size * grid_size);
+    energy = dirichlet_energy_on_grid(vtx2val, grid_size);
+    worklist.clear();
+    vtx2isinlist.assign(grid_size * grid_size, 0);
+    for (unsigned int idx = 0; idx < grid_size * grid_size; ++idx) {
+      if (vtx2isfix[idx]) { continue; }
+      worklist.push_back(idx);
+      vtx2isinlist[idx] = 1;
+    }
+  }
+
+  /**
+   * visit the cells in the worklist once. The cells pushed during the sweep are visited in the next sweep.
+   * @return number of the cells visited
+   */
+  unsigned int sweep(std::vector<float> &vtx2val) {
+    const unsigned int n = grid_size;
+    worklist_cur.swap(worklist);
+    worklist.clear();
+    for (unsigned int idx: worklist_cur) { vtx2isinlist[idx] = 0; }
+    for (unsigned int idx: worklist_cur) {
+      const unsigned int ix = idx % n;
+      const unsigned int iy = idx / n;
+      unsigned int idx_adj[4];
+      unsigned int num_adj = 0;
+      if (ix > 0) { idx_adj[num_adj++] = idx - 1; }
+      if (ix < n - 1) { idx_adj[num_adj++] = idx + 1; }
+      if (iy > 0) { idx_adj[num_adj++] = idx - n; }
+      if (iy < n - 1) { idx_adj[num_adj++] = idx + n; }
+      float sum = 0.f;
+      for (unsigned int i = 0; i < num_adj; ++i) { sum += vtx2val[idx_adj[i]]; }
+      const float val_old = vtx2val[idx];
+      if (std::abs(sum - static_cast<float>(num_adj) * val_old) <= threshold) { continue; }
+      const float val_new = sum / static_cast<float>(num_adj);
+      vtx2val[idx] = val_new;
+      for (unsigned int i = 0; i < num_adj; ++i) {
+        const double val_adj = vtx2val[idx_adj[i]];
+        energy += 0.5 * ((val_new - val_adj) * (val_new - val_adj) - (val_old - val_adj) * (val_old - val_adj));
+        if (vtx2isfix[idx_adj[i]] || vtx2isinlist[idx_adj[i]]) { continue; }
+        worklist.push_back(idx_adj[i]);
+        vtx2isinlist[idx_adj[i]] = 1;
+      }
+    }
+    return worklist_cur.size();
+  }
+
+  [[nodiscard]] unsigned int num_active() const { return worklist.size(); }
+
+ public:
+  unsigned int grid_size = 0;
+  float threshold = 1.0e-5f;
+  double energy = 0.; // Dirichlet's energy updated incrementally
+ private:
+  std::vector<bool> vtx2isfix;
+  std::vector<unsigned int> worklist; // cells to be visited in the next sweep
+  std::vector<unsigned int> worklist_cur;
+  std::vector<unsigned char> vtx2isinlist;
+};
+
+} // namespace pba
+
+#endif //PBA_GRID_LAPLACE_H_
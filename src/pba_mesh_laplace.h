@@ -0,0 +1,117 @@
+//
+// solvers of the Laplace equation with the Dirichlet boundary condition on an unstructured mesh
+//
+
+#ifndef PBA_MESH_LAPLACE_H_
+#define PBA_MESH_LAPLACE_H_
+
+#include <vector>
+#include <cassert>
+#include <cmath>
+#include <tuple>
+#include <Eigen/Dense>
+
+#include "pba_parallel.h"
+#include "pba_util_eigen.h"
+
+namespace pba {
+
+/**
+ * Gauss-Seidel method in the multicolor order for the graph Laplacian of a mesh (i.e., the Dirichlet's energy
+ * 1/2 sum (u_i - u_j)^2 over the edges). The free vertices are colored such that no two adjacent vertices share
+ * a color, so the vertices of one color only read the vertices of the other colors and are updated in parallel.
+ * For a large mesh, renumbering the vertices with `pba::reorder_mesh_vertices` beforehand improves the locality.
+ */
+class MeshLaplaceMulticolor {
+ public:
+  /**
+   * @param elem2vtx element's connectivity (e.g., tri2vtx)
+   * @param vtx2isfix Dirichlet condition. The values of the fixed vertices are not changed
+   */
+  template<typename VTX2ISFIX>
+  void initialize(
+      const Eigen::MatrixXi &elem2vtx,
+      unsigned int num_vtx,
+      const VTX2ISFIX &vtx2isfix) {
+    assert(static_cast<unsigned int>(vtx2isfix.size()) == num_vtx);
+    const auto[vtx2jdx, jdx2vtx] = pba::vertex_to_vertex_parallel(elem2vtx, num_vtx);
+    // remove the vertex itself from its adjacency.
+    // The rows are counted because a vertex referenced by no element (e.g., in an OBJ file) has an empty row
+    vtx2idx.assign(num_vtx + 1, 0);
+    pba::parallel_for(num_vtx, [&](unsigned int i_vtx_begin, unsigned int i_vtx_end) {
+      for (unsigned int i_vtx = i_vtx_begin; i_vtx < i_vtx_end; ++i_vtx) {
+        for (unsigned int jdx = vtx2jdx[i_vtx]; jdx < vtx2jdx[i_vtx + 1]; ++jdx) {
+          if (jdx2vtx[jdx] != i_vtx) { vtx2idx[i_vtx + 1] += 1; }
+        }
+      }
+    });
+    for (unsigned int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) {
+      vtx2idx[i_vtx + 1] += vtx2idx[i_vtx];
+    }
+    idx2vtx.resize(vtx2idx[num_vtx]);
+    pba::parallel_for(num_vtx, [&](unsigned int i_vtx_begin, unsigned int i_vtx_end) {
+      for (unsigned int i_vtx = i_vtx_begin; i_vtx < i_vtx_end; ++i_vtx) {
+        unsigned int idx = vtx2idx[i_vtx];
+        for (unsigned int jdx = vtx2jdx[i_vtx]; jdx < vtx2jdx[i_vtx + 1]; ++jdx) {
+          if (jdx2vtx[jdx] != i_vtx) { idx2vtx[idx++] = jdx2vtx[jdx]; }
+        }
+        assert(idx == vtx2idx[i_vtx + 1]);
+      }
+    });
+    std::vector<bool> vtx2isfree(num_vtx);
+    for (unsigned int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) { vtx2isfree[i_vtx] = !vtx2isfix[i_vtx]; }
+    std::tie(color2jdx, jdx2vtx_free) = pba::greedy_vertex_coloring(vtx2idx, idx2vtx, vtx2isfree);
+  }
+
+  /**
+   * one sweep: the free vertices are updated color by color
+   * @param num_thread number of threads. The default number is used if zero
+   */
+  void sweep(
+      std::vector<float> &vtx2val,
+      unsigned int num_thread = 0) const {
+    assert(vtx2val.size() + 1 == vtx2idx.size());
+    for (unsigned int i_color = 0; i_color < num_color(); ++i_color) {
+      const unsigned int jdx0 = color2jdx[i_color];
+      pba::parallel_for(color2jdx[i_color + 1] - jdx0, [&](unsigned int i_begin, unsigned int i_end) {
+        for (unsigned int jdx = jdx0 + i_begin; jdx < jdx0 + i_end; ++jdx) {
+          const unsigned int i_vtx = jdx2vtx_free[jdx];
+          const unsigned int num_adj = vtx2idx[i_vtx + 1] - vtx2idx[i_vtx];
+          if (num_adj == 0) { continue; }
+          float sum = 0.f;
+          for (unsigned int idx = vtx2idx[i_vtx]; idx < vtx2idx[i_vtx + 1]; ++idx) {
+            sum += vtx2val[idx2vtx[idx]];
+          }
+          vtx2val[i_vtx] = sum / static_cast<float>(num_adj);
+        }
+      }, num_thread);
+    }
+  }
+
+  /**
+   * @return L2 norm of the residual sum (u_i - u_j) over the free vertices
+   */
+  [[nodiscard]] double residual_norm(const std::vector<float> &vtx2val) const {
+    double sum = 0.;
+    for (unsigned int i_vtx: jdx2vtx_free) {
+      double res = 0.;
+      for (unsigned int idx = vtx2idx[i_vtx]; idx < vtx2idx[i_vtx + 1]; ++idx) {
+        res += vtx2val[i_vtx] - vtx2val[idx2vtx[idx]];
+      }
+      sum += res * res;
+    }
+    return std::sqrt(sum);
+  }
+
+  [[nodiscard]] unsigned int num_color() const { return color2jdx.size() - 1; }
+
+ public:
+  std::vector<unsigned int> vtx2idx; // adjacency of the vertices without the vertex itself
+  std::vector<unsigned int> idx2vtx;
+  std::vector<unsigned int> color2jdx; // free vertices of each color
+  std::vector<unsigned int> jdx2vtx_free;
+};
+
+} // namespace pba
+
+#endif //PBA_MESH_LAPLACE_H_
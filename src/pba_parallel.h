@@ -0,0 +1,79 @@
+//
+// simple thread-parallel loops
+//
+
+#ifndef PBA_PARALLEL_H_
+#define PBA_PARALLEL_H_
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+namespace pba {
+
+/**
+ * number of threads used by default
+ */
+inline unsigned int num_thread_default() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * split the range [0, num) into contiguous sub-ranges and process them in parallel
+ * @param num size of the range
+ * @param func function called as func(i_begin, i_end) for each sub-range
+ * @param num_thread number of threads. The default number is used if zero
+ */
+template<typename FUNC>
+void parallel_for(
+    unsigned int num,
+    FUNC &&func,
+    unsigned int num_thread = 0) {
+  if (num_thread == 0) { num_thread = num_thread_default(); }
+  num_thread = std::min(num_thread, num);
+  if (num_thread <= 1) {
+    if (num > 0) { func(0u, num); }
+    return;
+  }
+  std::vector<std::thread> threads;
+  threads.reserve(num_thread);
+  for (unsigned int i_thread = 0; i_thread < num_thread; ++i_thread) {
+    const unsigned int i_begin = static_cast<unsigned int>(static_cast<size_t>(num) * i_thread / num_thread);
+    const unsigned int i_end = static_cast<unsigned int>(static_cast<size_t>(num) * (i_thread + 1) / num_thread);
+    threads.emplace_back([&func, i_begin, i_end]() { func(i_begin, i_end); });
+  }
+  for (auto &thread: threads) { thread.join(); }
+}
+
+/**
+ * sum of the partial results over the range [0, num) computed in parallel.
+ * The range is split into chunks of a fixed size and the partial results are added in the order of the chunks,
+ * so the result is deterministic and does not depend on the number of threads.
+ * @param zero initial value of the sum (e.g., 0. or Eigen::Vector3d::Zero())
+ * @param func function called as func(i_begin, i_end) for each chunk that returns the partial result
+ * @param chunk_size number of the items in one chunk
+ * @param num_thread number of threads. The default number is used if zero
+ */
+template<typename T, typename FUNC>
+T parallel_reduce_sum(
+    unsigned int num,
+    const T &zero,
+    FUNC &&func,
+    unsigned int chunk_size = 4096,
+    unsigned int num_thread = 0) {
+  const unsigned int num_chunk = (num + chunk_size - 1) / chunk_size;
+  std::vector<T> chunk2sum(num_chunk, zero);
+  parallel_for(num_chunk, [&](unsigned int i_chunk_begin, unsigned int i_chunk_end) {
+    for (unsigned int i_chunk = i_chunk_begin; i_chunk < i_chunk_end; ++i_chunk) {
+      const unsigned int i_begin = i_chunk * chunk_size;
+      chunk2sum[i_chunk] = func(i_begin, std::min(i_begin + chunk_size, num));
+    }
+  }, num_thread);
+  T sum = zero;
+  for (const T &val: chunk2sum) { sum += val; }
+  return sum;
+}
+
+} // namespace pba
+
+#endif //PBA_PARALLEL_H_
@@ -0,0 +1,220 @@
+//
+// energies of a rigid body evaluated with the precomputed moments of its vertices, their minimization,
+// and the time integration of the free rigid body
+//
+
+#ifndef PBA_RIGID_BODY_H_
+#define PBA_RIGID_BODY_H_
+
+#include <cassert>
+#include <Eigen/Dense>
+
+namespace pba {
+
+/**
+ * Potential energy of a rigid body whose vertices X_i move to R X_i + t:
+ * a penalty spring that pulls the vertex X_fix to the target position, and the gravity on all the vertices,
+ *   E(R, t) = 1/2 k |R X_fix + t - X_trg|^2 - sum_i g^T (R X_i + t).
+ * The sum over the vertices is N g^T t + g^T R S1 where N is the number of vertices and S1 = sum_i X_i
+ * is the first moment, so the energy and its derivatives are evaluated in O(1) after `initialize`.
+ * The rotation is differentiated w.r.t. o, where the rotation is updated as R exp([o]_x) (i.e., in the body frame).
+ * The moments are stored in double, and the energy can be evaluated either in float or in double.
+ */
+class RigidBodyGravityEnergy {
+ public:
+  /**
+   * precompute the moments of the vertices
+   * @param vtx2xyz_ini vertices' coordinates in the body frame
+   * @param i_vtx_fix index of the vertex pulled by the spring
+   * @param xyz_trg target position of the vertex
+   */
+  template<typename VTX2XYZ>
+  void initialize(
+      const VTX2XYZ &vtx2xyz_ini,
+      unsigned int i_vtx_fix,
+      const Eigen::Vector3f &xyz_trg,
+      float penalty_,
+      const Eigen::Vector3f &gravity_) {
+    assert(i_vtx_fix < static_cast<unsigned int>(vtx2xyz_ini.rows()));
+    num_vtx = static_cast<double>(vtx2xyz_ini.rows());
+    moment1 = vtx2xyz_ini.template cast<double>().colwise().sum().transpose();
+    xyz_fix = vtx2xyz_ini.row(i_vtx_fix).transpose().template cast<double>();
+    xyz_target = xyz_trg.cast<double>();
+    penalty = penalty_;
+    gravity = gravity_.cast<double>();
+  }
+
+  template<typename REAL>
+  [[nodiscard]] REAL energy(
+      const Eigen::Matrix<REAL, 3, 3> &rotation,
+      const Eigen::Matrix<REAL, 3, 1> &translation) const {
+    const Eigen::Matrix<REAL, 3, 1> t0 = rotation * xyz_fix.cast<REAL>() + translation - xyz_target.cast<REAL>();
+    return REAL(0.5) * REAL(penalty) * t0.squaredNorm()
+        - gravity.cast<REAL>().dot(rotation * moment1.cast<REAL>() + REAL(num_vtx) * translation);
+  }
+
+  /**
+   * @param [out] dEdo gradient w.r.t. the rotation
+   * @param [out] dEdt gradient w.r.t. the translation
+   */
+  template<typename REAL>
+  void gradient(
+      Eigen::Matrix<REAL, 3, 1> &dEdo,
+      Eigen::Matrix<REAL, 3, 1> &dEdt,
+      const Eigen::Matrix<REAL, 3, 3> &rotation,
+      const Eigen::Matrix<REAL, 3, 1> &translation) const {
+    const Eigen::Matrix<REAL, 3, 1> t0 = rotation * xyz_fix.cast<REAL>() + translation - xyz_target.cast<REAL>();
+    dEdt = REAL(penalty) * t0 - REAL(num_vtx) * gravity.cast<REAL>();
+    dEdo = xyz_fix.cast<REAL>().cross(rotation.transpose() * (REAL(penalty) * t0))
+        - moment1.cast<REAL>().cross(rotation.transpose() * gravity.cast<REAL>());
+  }
+
+  /**
+   * hessian w.r.t. (o, t) at o = 0. The terms from the second derivative of exp([o]_x) are symmetrized.
+   * @param is_gauss_newton if true, only the Gauss-Newton approximation J^T J of the spring is used
+   */
+  template<typename REAL>
+  void hessian(
+      Eigen::Matrix<REAL, 6, 6> &ddE,
+      const Eigen::Matrix<REAL, 3, 3> &rotation,
+      const Eigen::Matrix<REAL, 3, 1> &translation,
+      bool is_gauss_newton = false) const {
+    using Vector3 = Eigen::Matrix<REAL, 3, 1>;
+    using Matrix3 = Eigen::Matrix<REAL, 3, 3>;
+    const Vector3 p = xyz_fix.cast<REAL>();
+    const Vector3 t0 = rotation * p + translation - xyz_target.cast<REAL>();
+    Matrix3 skew_p;
+    skew_p << 0, -p.z(), p.y(), p.z(), 0, -p.x(), -p.y(), p.x(), 0;
+    const REAL k = REAL(penalty);
+    ddE.template block<3, 3>(0, 0) = -k * skew_p * skew_p;
+    ddE.template block<3, 3>(0, 3) = k * skew_p * rotation.transpose();
+    ddE.template block<3, 3>(3, 0) = ddE.template block<3, 3>(0, 3).transpose();
+    ddE.template block<3, 3>(3, 3) = k * Matrix3::Identity();
+    if (is_gauss_newton) { return; }
+    // 1/2 a^T [o]_x^2 x = 1/2 (a.o)(x.o) - 1/2 (a.x) |o|^2 for the spring and the gravity
+    auto add_second_order = [&ddE](const Vector3 &a, const Vector3 &x) {
+      ddE.template block<3, 3>(0, 0) += REAL(0.5) * (a * x.transpose() + x * a.transpose()) - a.dot(x) * Matrix3::Identity();
+    };
+    add_second_order(rotation.transpose() * (k * t0), p);
+    add_second_order(-rotation.transpose() * gravity.cast<REAL>(), moment1.cast<REAL>());
+  }
+
+ public:
+  double num_vtx = 0.; // zeroth moment
+  Eigen::Vector3d moment1 = Eigen::Vector3d::Zero(); // sum of the vertices' coordinates
+  Eigen::Vector3d xyz_fix = Eigen::Vector3d::Zero();
+  Eigen::Vector3d xyz_target = Eigen::Vector3d::Zero();
+  double penalty = 0.;
+  Eigen::Vector3d gravity = Eigen::Vector3d::Zero();
+};
+
+/**
+ * Levenberg-Marquardt method on SO(3) x R^3 for the energy of a rigid body (e.g., `RigidBodyGravityEnergy`).
+ * The step (o, t) solves the 6x6 system (H + mu I) [o, t] = -g, and the rotation is updated as R AngleAxis(o).
+ * The step is accepted only when it decreases the energy. Then the damping mu is decreased, otherwise it is
+ * increased and the step is solved again. Hence the iteration is the Newton's method near the minimum,
+ * while it falls back to the gradient descent far from it or where the hessian is indefinite.
+ */
+class RigidBodyLevenbergMarquardt {
+ public:
+  /**
+   * one iteration of the Levenberg-Marquardt method. The damping is kept for the next iteration
+   * @tparam ENERGY class with `energy`, `gradient` and `hessian` (see `RigidBodyGravityEnergy`)
+   * @return energy after the iteration
+   */
+  template<typename ENERGY>
+  double iterate(
+      Eigen::Matrix3f &rotation,
+      Eigen::Vector3f &translation,
+      const ENERGY &rigid_energy) {
+    const Eigen::Matrix3d R0 = rotation.cast<double>();
+    const Eigen::Vector3d t0 = translation.cast<double>();
+    const double E0 = rigid_energy.energy(R0, t0);
+    Eigen::Vector3d dEdo, dEdt;
+    rigid_energy.gradient(dEdo, dEdt, R0, t0);
+    Eigen::Matrix<double, 6, 1> dE;
+    dE << dEdo, dEdt;
+    Eigen::Matrix<double, 6, 6> ddE;
+    rigid_energy.hessian(ddE, R0, t0, is_gauss_newton);
+    if (damping < 0.) { damping = 1.0e-3 * ddE.diagonal().cwiseAbs().maxCoeff(); }
+    for (unsigned int itr = 0; itr < max_trial; ++itr) {
+      const Eigen::LLT<Eigen::Matrix<double, 6, 6> > llt(ddE + damping * Eigen::Matrix<double, 6, 6>::Identity());
+      if (llt.info() == Eigen::Success) {
+        const Eigen::Matrix<double, 6, 1> upd = -llt.solve(dE);
+        const Eigen::Vector3d o = upd.head<3>();
+        const Eigen::Matrix3d R1 = R0 * Eigen::AngleAxisd(o.norm(), o.stableNormalized()).toRotationMatrix();
+        const Eigen::Vector3d t1 = t0 + upd.tail<3>();
+        const double E1 = rigid_energy.energy(R1, t1);
+        if (E1 < E0) {
+          rotation = R1.cast<float>();
+          translation = t1.cast<float>();
+          damping *= 1. / 3.;
+          return E1;
+        }
+      }
+      damping *= 4.;
+    }
+    return E0; // no step decreases the energy (i.e., converged)
+  }
+
+ public:
+  bool is_gauss_newton = false; // use the Gauss-Newton approximation of the hessian instead of the exact one
+  double damping = -1.; // damping of the Levenberg-Marquardt method. initialized from the hessian if negative
+  unsigned int max_trial = 32;
+};
+
+/**
+ * Symplectic integrator of the free rigid body on SO(3) by the splitting of the kinetic energy.
+ * In the principal frame, the energy is H = H1 + H2 + H3 with Hi = Li^2 / (2 Ii), where L is the angular momentum
+ * in the body frame. The flow of each Hi is exactly a rotation around the principal axis i by the angle h Li / Ii.
+ * One step is the symmetric composition H1(h/2) H2(h/2) H3(h) H2(h/2) H1(h/2), which is second order,
+ * keeps the rotation orthogonal and conserves the norm of the angular momentum and the angular momentum
+ * in the world frame up to the round-off error. The energy error stays bounded without drift.
+ */
+class FreeRigidBodySplitting {
+ public:
+  /**
+   * @param inertia inertia tensor in the body frame
+   */
+  void initialize(const Eigen::Matrix3d &inertia) {
+    const Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigen(inertia);
+    principal_axes = eigen.eigenvectors();
+    if (principal_axes.determinant() < 0.) { principal_axes.col(2) *= -1.; } // make it a rotation
+    principal_moments = eigen.eigenvalues();
+  }
+
+  /**
+   * @param [in,out] rotation rotation from the body frame to the world frame
+   * @param [in,out] Omega angular velocity in the body frame (\dot{R} = R * Skew(\Omega))
+   * @param [in] dt time step
+   */
+  template<typename REAL>
+  void step(
+      Eigen::Matrix<REAL, 3, 3> &rotation,
+      Eigen::Matrix<REAL, 3, 1> &Omega,
+      REAL dt) const {
+    Eigen::Matrix3d rotation_p = rotation.template cast<double>() * principal_axes;
+    Eigen::Vector3d L_p = principal_moments.cwiseProduct(principal_axes.transpose() * Omega.template cast<double>());
+    auto flow = [&](unsigned int i_axis, double h) {
+      const Eigen::Matrix3d Q = Eigen::AngleAxisd(
+          h * L_p(i_axis) / principal_moments(i_axis), Eigen::Vector3d::Unit(i_axis)).toRotationMatrix();
+      rotation_p = rotation_p * Q;
+      L_p = Q.transpose() * L_p;
+    };
+    flow(0, 0.5 * dt);
+    flow(1, 0.5 * dt);
+    flow(2, dt);
+    flow(1, 0.5 * dt);
+    flow(0, 0.5 * dt);
+    rotation = (rotation_p * principal_axes.transpose()).template cast<REAL>();
+    Omega = (principal_axes * L_p.cwiseQuotient(principal_moments)).template cast<REAL>();
+  }
+
+ public:
+  Eigen::Matrix3d principal_axes = Eigen::Matrix3d::Identity(); // columns are the principal axes in the body frame
+  Eigen::Vector3d principal_moments = Eigen::Vector3d::Ones();
+};
+
+} // namespace pba
+
+#endif //PBA_RIGID_BODY_H_
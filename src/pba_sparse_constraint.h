@@ -0,0 +1,147 @@
+//
+// scalar constraints with sparse gradients for the Lagrange-multiplier method
+//
+
+#ifndef PBA_SPARSE_CONSTRAINT_H_
+#define PBA_SPARSE_CONSTRAINT_H_
+
+#include <vector>
+#include <utility>
+#include <cassert>
+#include <Eigen/Dense>
+
+namespace pba {
+
+/**
+ * Jacobian of the scalar constraints C_k(x) = 0 on the vertices' xyz-coordinates.
+ * The k-th row is the gradient of C_k, which is stored as the pairs of a vertex and a 3D vector in the CSR format,
+ * so the cost of the operations grows with the number of the non-zero entries, not with the number of vertices.
+ * The same vertex can appear more than once in a row (the values are summed).
+ */
+class SparseConstraintJacobian {
+ public:
+  void clear() {
+    con2value.clear();
+    con2idx.assign(1, 0);
+    idx2vtx.clear();
+    idx2grad.clear();
+  }
+
+  /**
+   * start a new constraint. The gradient is given by the following calls of `add_gradient`
+   * @param value value of the constraint C_k(x)
+   * @return index of the constraint
+   */
+  unsigned int add_constraint(double value) {
+    if (con2idx.empty()) { con2idx.push_back(0); }
+    con2value.push_back(value);
+    con2idx.push_back(con2idx.back());
+    return num_constraint() - 1;
+  }
+
+  /**
+   * add the gradient of the last constraint w.r.t. the vertex
+   */
+  void add_gradient(unsigned int i_vtx, const Eigen::Vector3d &grad) {
+    assert(num_constraint() > 0);
+    idx2vtx.push_back(i_vtx);
+    idx2grad.push_back(grad);
+    con2idx.back() += 1;
+  }
+
+  [[nodiscard]] unsigned int num_constraint() const { return con2value.size(); }
+
+  /**
+   * @return values of the constraints
+   */
+  [[nodiscard]] Eigen::VectorXd values() const {
+    return Eigen::Map<const Eigen::VectorXd>(con2value.data(), num_constraint());
+  }
+
+  /**
+   * @return J x
+   */
+  [[nodiscard]] Eigen::VectorXd multiply(const Eigen::MatrixX3d &x) const {
+    Eigen::VectorXd y(num_constraint());
+    for (unsigned int i_con = 0; i_con < num_constraint(); ++i_con) {
+      double sum = 0.;
+      for (unsigned int idx = con2idx[i_con]; idx < con2idx[i_con + 1]; ++idx) {
+        sum += idx2grad[idx].dot(x.row(idx2vtx[idx]));
+      }
+      y(i_con) = sum;
+    }
+    return y;
+  }
+
+  /**
+   * y += J^T lambda
+   */
+  void add_transpose_multiply(
+      Eigen::MatrixX3d &y,
+      const Eigen::VectorXd &lambda) const {
+    assert(static_cast<unsigned int>(lambda.size()) == num_constraint());
+    for (unsigned int i_con = 0; i_con < num_constraint(); ++i_con) {
+      for (unsigned int idx = con2idx[i_con]; idx < con2idx[i_con + 1]; ++idx) {
+        y.row(idx2vtx[idx]) += lambda(i_con) * idx2grad[idx].transpose();
+      }
+    }
+  }
+
+  /**
+   * gradient of one constraint as an (num_vtx x 3) matrix
+   */
+  [[nodiscard]] Eigen::MatrixX3d gradient(
+      unsigned int i_con,
+      unsigned int num_vtx) const {
+    Eigen::MatrixX3d grad = Eigen::MatrixX3d::Zero(num_vtx, 3);
+    for (unsigned int idx = con2idx[i_con]; idx < con2idx[i_con + 1]; ++idx) {
+      grad.row(idx2vtx[idx]) += idx2grad[idx].transpose();
+    }
+    return grad;
+  }
+
+ public:
+  std::vector<double> con2value;
+  std::vector<unsigned int> con2idx = {0};
+  std::vector<unsigned int> idx2vtx;
+  std::vector<Eigen::Vector3d> idx2grad;
+};
+
+/**
+ * solve the KKT system [[K, J^T], [J, 0]] [dx, dl] = [g, r] using the Schur complement on the factorized K.
+ * With u = K^{-1} g and B = K^{-1} J^T (one solve per constraint), the multipliers are given by the small
+ * dense system (J B) dl = J u - r, then dx = u - B dl.
+ * @tparam SOLVER class with `solve(r)` that returns K^{-1} r for an (num_vtx x 3) matrix (e.g., `BlockSparseCholesky<3>`)
+ * @param solver factorization of K
+ * @param jacobian constraints' Jacobian J
+ * @param g right hand side for the coordinates (e.g., gradient of the Lagrangian)
+ * @param r right hand side for the multipliers (e.g., values of the constraints)
+ * @return (dx, dl)
+ */
+template<typename SOLVER>
+std::pair<Eigen::MatrixX3d, Eigen::VectorXd> solve_kkt_with_schur_complement(
+    const SOLVER &solver,
+    const SparseConstraintJacobian &jacobian,
+    const Eigen::MatrixX3d &g,
+    const Eigen::VectorXd &r) {
+  const unsigned int num_vtx = g.rows();
+  const unsigned int num_con = jacobian.num_constraint();
+  assert(static_cast<unsigned int>(r.size()) == num_con);
+  Eigen::MatrixX3d dx = solver.solve(g);
+  if (num_con == 0) { return {dx, Eigen::VectorXd(0)}; }
+  std::vector<Eigen::MatrixX3d> con2b(num_con);
+  Eigen::MatrixXd schur(num_con, num_con);
+  for (unsigned int j_con = 0; j_con < num_con; ++j_con) {
+    con2b[j_con] = solver.solve(jacobian.gradient(j_con, num_vtx));
+    schur.col(j_con) = jacobian.multiply(con2b[j_con]);
+  }
+  const Eigen::VectorXd dl = schur.partialPivLu().solve(jacobian.multiply(dx) - r);
+  for (unsigned int j_con = 0; j_con < num_con; ++j_con) {
+    dx -= con2b[j_con] * dl(j_con);
+  }
+  return {dx, dl};
+}
+
+} // namespace pba
+
+#endif //PBA_SPARSE_CONSTRAINT_H_
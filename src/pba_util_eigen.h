@@ -12,6 +12,10 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <algorithm>
+#include <climits>
+
+#include "pba_parallel.h"
 
 namespace pba {
 
@@ -134,6 +138,178 @@ auto lines_of_mesh(
   return Eigen::Matrix<int, Eigen::Dynamic, 2, Eigen::RowMajor>(map);
 }
 
+/**
+ * gather the vertices of the elements around each vertex, then sort and unique them in place.
+ * The result is written into a buffer preallocated with the upper bound of the adjacency size.
+ * @param vtx2kdx (out) offset of each vertex's adjacency in `kdx2vtx`
+ * @param vtx2num (out) number of adjacent vertices for each vertex
+ * @param kdx2vtx (out) buffer of the adjacent vertices
+ * @param is_upper only the vertices with the larger index are kept
+ */
+void gather_sorted_adjacency_parallel(
+    std::vector<unsigned int> &vtx2kdx,
+    std::vector<unsigned int> &vtx2num,
+    std::vector<unsigned int> &kdx2vtx,
+    const Eigen::MatrixXi &elem2vtx,
+    size_t num_vtx,
+    bool is_upper) {
+  const auto[vtx2idx, idx2elem] = vertex_to_elem(elem2vtx, num_vtx);
+  const unsigned int num_node = elem2vtx.cols();
+  vtx2kdx.resize(num_vtx + 1);
+  for (unsigned int i_vtx = 0; i_vtx < num_vtx + 1; ++i_vtx) {
+    vtx2kdx[i_vtx] = vtx2idx[i_vtx] * num_node;
+  }
+  vtx2num.assign(num_vtx, 0);
+  kdx2vtx.resize(vtx2kdx[num_vtx]);
+  pba::parallel_for(num_vtx, [&](unsigned int i_vtx_begin, unsigned int i_vtx_end) {
+    for (unsigned int i_vtx = i_vtx_begin; i_vtx < i_vtx_end; ++i_vtx) {
+      unsigned int *begin = kdx2vtx.data() + vtx2kdx[i_vtx];
+      unsigned int *end = begin;
+      for (unsigned int idx = vtx2idx[i_vtx]; idx < vtx2idx[i_vtx + 1]; ++idx) {
+        const unsigned int i_elem = idx2elem[idx];
+        for (unsigned int i_node = 0; i_node < num_node; ++i_node) {
+          const unsigned int j_vtx = elem2vtx(i_elem, i_node);
+          if (is_upper && j_vtx <= i_vtx) { continue; }
+          *(end++) = j_vtx;
+        }
+      }
+      std::sort(begin, end);
+      vtx2num[i_vtx] = std::distance(begin, std::unique(begin, end));
+    }
+  });
+}
+
+/**
+ * same as `vertex_to_vertex` but the adjacency is built with the two-pass count & fill in parallel
+ */
+auto vertex_to_vertex_parallel(
+    const Eigen::MatrixXi &elem2vtx,
+    size_t num_vtx) {
+  std::vector<unsigned int> vtx2kdx, vtx2num, kdx2vtx;
+  gather_sorted_adjacency_parallel(
+      vtx2kdx, vtx2num, kdx2vtx,
+      elem2vtx, num_vtx, false);
+  std::vector<unsigned int> vtx2jdx(num_vtx + 1, 0);
+  for (unsigned int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) {
+    vtx2jdx[i_vtx + 1] = vtx2jdx[i_vtx] + vtx2num[i_vtx];
+  }
+  std::vector<unsigned int> jdx2vtx(vtx2jdx[num_vtx]);
+  pba::parallel_for(num_vtx, [&](unsigned int i_vtx_begin, unsigned int i_vtx_end) {
+    for (unsigned int i_vtx = i_vtx_begin; i_vtx < i_vtx_end; ++i_vtx) {
+      std::copy_n(kdx2vtx.begin() + vtx2kdx[i_vtx], vtx2num[i_vtx], jdx2vtx.begin() + vtx2jdx[i_vtx]);
+    }
+  });
+  return std::make_pair(vtx2jdx, jdx2vtx);
+}
+
+/**
+ * same as `lines_of_mesh` but the lines are built with the two-pass count & fill in parallel
+ */
+auto lines_of_mesh_parallel(
+    const Eigen::MatrixXi &elem2vtx,
+    int num_vtx) {
+  std::vector<unsigned int> vtx2kdx, vtx2num, kdx2vtx;
+  gather_sorted_adjacency_parallel(
+      vtx2kdx, vtx2num, kdx2vtx,
+      elem2vtx, num_vtx, true);
+  std::vector<unsigned int> vtx2jdx(num_vtx + 1, 0);
+  for (int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) {
+    vtx2jdx[i_vtx + 1] = vtx2jdx[i_vtx] + vtx2num[i_vtx];
+  }
+  Eigen::Matrix<int, Eigen::Dynamic, 2, Eigen::RowMajor> line2vtx(vtx2jdx[num_vtx], 2);
+  pba::parallel_for(num_vtx, [&](unsigned int i_vtx_begin, unsigned int i_vtx_end) {
+    for (unsigned int i_vtx = i_vtx_begin; i_vtx < i_vtx_end; ++i_vtx) {
+      for (unsigned int i = 0; i < vtx2num[i_vtx]; ++i) {
+        line2vtx(vtx2jdx[i_vtx] + i, 0) = static_cast<int>(i_vtx);
+        line2vtx(vtx2jdx[i_vtx] + i, 1) = static_cast<int>(kdx2vtx[vtx2kdx[i_vtx] + i]);
+      }
+    }
+  });
+  return line2vtx;
+}
+
+/**
+ * greedy coloring of a graph such that the adjacent vertices have different colors.
+ * Each vertex takes the smallest color not used by its adjacent vertices visited before.
+ * @param vtx2idx offset of the adjacency for each vertex (e.g., output of `vertex_to_vertex`)
+ * @param idx2vtx adjacent vertices (the vertex itself is ignored)
+ * @param vtx2isvalid only these vertices are colored. All the vertices are colored if empty
+ * @return (color2jdx, jdx2vtx): the vertices of each color in the ascending order in the CSR format
+ */
+auto greedy_vertex_coloring(
+    const std::vector<unsigned int> &vtx2idx,
+    const std::vector<unsigned int> &idx2vtx,
+    const std::vector<bool> &vtx2isvalid = {}) {
+  const unsigned int num_vtx = vtx2idx.size() - 1;
+  assert(vtx2isvalid.empty() || vtx2isvalid.size() == num_vtx);
+  std::vector<unsigned int> vtx2color(num_vtx, UINT_MAX);
+  std::vector<unsigned int> color2stamp; // the last vertex that marked the color as used
+  for (unsigned int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) {
+    if (!vtx2isvalid.empty() && !vtx2isvalid[i_vtx]) { continue; }
+    for (unsigned int idx = vtx2idx[i_vtx]; idx < vtx2idx[i_vtx + 1]; ++idx) {
+      const unsigned int i_color = vtx2color[idx2vtx[idx]];
+      if (i_color != UINT_MAX) { color2stamp[i_color] = i_vtx; }
+    }
+    unsigned int i_color = 0;
+    while (i_color < color2stamp.size() && color2stamp[i_color] == i_vtx) { ++i_color; }
+    if (i_color == color2stamp.size()) { color2stamp.push_back(UINT_MAX); }
+    vtx2color[i_vtx] = i_color;
+  }
+  const unsigned int num_color = color2stamp.size();
+  std::vector<unsigned int> color2jdx(num_color + 1, 0);
+  for (unsigned int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) {
+    if (vtx2color[i_vtx] != UINT_MAX) { color2jdx[vtx2color[i_vtx] + 1] += 1; }
+  }
+  for (unsigned int i_color = 0; i_color < num_color; ++i_color) {
+    color2jdx[i_color + 1] += color2jdx[i_color];
+  }
+  std::vector<unsigned int> jdx2vtx(color2jdx[num_color]);
+  std::vector<unsigned int> color2fill(color2jdx.begin(), color2jdx.end() - 1);
+  for (unsigned int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) {
+    if (vtx2color[i_vtx] != UINT_MAX) { jdx2vtx[color2fill[vtx2color[i_vtx]]++] = i_vtx; }
+  }
+  return std::make_pair(color2jdx, jdx2vtx);
+}
+
+/**
+ * greedy coloring of the elements such that the elements sharing a vertex have different colors.
+ * The elements of one color can scatter their values to the vertices (or to the blocks of a sparse matrix)
+ * in parallel without the race condition.
+ * @param elem2vtx element's connectivity (e.g., line2vtx, tri2vtx)
+ * @return (color2jdx, jdx2elem): the elements of each color in the ascending order in the CSR format
+ */
+template<typename ELEM2VTX>
+auto greedy_element_coloring(
+    const ELEM2VTX &elem2vtx,
+    size_t num_vtx) {
+  const auto[vtx2idx, idx2elem] = vertex_to_elem(elem2vtx, num_vtx);
+  const unsigned int num_elem = elem2vtx.rows();
+  std::vector<unsigned int> elem2color(num_elem, UINT_MAX);
+  std::vector<unsigned int> color2stamp; // the last element that marked the color as used
+  for (unsigned int i_elem = 0; i_elem < num_elem; ++i_elem) {
+    for (int i_node = 0; i_node < elem2vtx.cols(); ++i_node) {
+      const unsigned int i_vtx = elem2vtx(i_elem, i_node);
+      for (unsigned int idx = vtx2idx[i_vtx]; idx < vtx2idx[i_vtx + 1]; ++idx) {
+        const unsigned int i_color = elem2color[idx2elem[idx]];
+        if (i_color != UINT_MAX) { color2stamp[i_color] = i_elem; }
+      }
+    }
+    unsigned int i_color = 0;
+    while (i_color < color2stamp.size() && color2stamp[i_color] == i_elem) { ++i_color; }
+    if (i_color == color2stamp.size()) { color2stamp.push_back(UINT_MAX); }
+    elem2color[i_elem] = i_color;
+  }
+  const unsigned int num_color = color2stamp.size();
+  std::vector<unsigned int> color2jdx(num_color + 1, 0);
+  for (unsigned int i_elem = 0; i_elem < num_elem; ++i_elem) { color2jdx[elem2color[i_elem] + 1] += 1; }
+  for (unsigned int i_color = 0; i_color < num_color; ++i_color) { color2jdx[i_color + 1] += color2jdx[i_color]; }
+  std::vector<unsigned int> jdx2elem(num_elem);
+  std::vector<unsigned int> color2fill(color2jdx.begin(), color2jdx.end() - 1);
+  for (unsigned int i_elem = 0; i_elem < num_elem; ++i_elem) { jdx2elem[color2fill[elem2color[i_elem]]++] = i_elem; }
+  return std::make_pair(color2jdx, jdx2elem);
+}
+
+
 Eigen::Vector3f unit_normal_of_triangle(
     const Eigen::Vector3f& v1,
     const Eigen::Vector3f& v2,
@@ -0,0 +1,178 @@
+//
+// bandwidth-reducing renumbering of the mesh's vertices
+//
+
+#ifndef PBA_VERTEX_REORDERING_H_
+#define PBA_VERTEX_REORDERING_H_
+
+#include <vector>
+#include <climits>
+#include <cassert>
+#include <algorithm>
+#include <Eigen/Dense>
+
+#include "pba_util_eigen.h"
+
+namespace pba {
+
+/**
+ * Reverse Cuthill-McKee ordering of a graph given in the CSR format (e.g., output of `vertex_to_vertex`).
+ * Each connected component is traversed from a pseudo-peripheral vertex.
+ * @param vtx2idx offset of the adjacency for each vertex
+ * @param idx2vtx adjacent vertices (the vertex itself can be included)
+ * @return new2old: the old index of the vertex for each new index
+ */
+std::vector<unsigned int> reverse_cuthill_mckee_ordering(
+    const std::vector<unsigned int> &vtx2idx,
+    const std::vector<unsigned int> &idx2vtx) {
+  const unsigned int num_vtx = vtx2idx.size() - 1;
+  std::vector<unsigned int> vtx2degree(num_vtx);
+  for (unsigned int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) {
+    vtx2degree[i_vtx] = vtx2idx[i_vtx + 1] - vtx2idx[i_vtx];
+  }
+  std::vector<unsigned int> vtx2level(num_vtx, UINT_MAX);
+  std::vector<unsigned int> queue;
+  // breadth first search from i_vtx_start. return the last vertex of the lowest degree in the last level
+  auto bfs = [&](unsigned int i_vtx_start) {
+    queue.assign(1, i_vtx_start);
+    vtx2level[i_vtx_start] = 0;
+    for (unsigned int iq = 0; iq < queue.size(); ++iq) {
+      const unsigned int i_vtx = queue[iq];
+      for (unsigned int idx = vtx2idx[i_vtx]; idx < vtx2idx[i_vtx + 1]; ++idx) {
+        const unsigned int j_vtx = idx2vtx[idx];
+        if (vtx2level[j_vtx] != UINT_MAX) { continue; }
+        vtx2level[j_vtx] = vtx2level[i_vtx] + 1;
+        queue.push_back(j_vtx);
+      }
+    }
+    unsigned int i_vtx_far = queue.back();
+    for (unsigned int i_vtx: queue) {
+      if (vtx2level[i_vtx] != vtx2level[queue.back()]) { continue; }
+      if (vtx2degree[i_vtx] < vtx2degree[i_vtx_far]) { i_vtx_far = i_vtx; }
+    }
+    const unsigned int height = vtx2level[queue.back()];
+    for (unsigned int i_vtx: queue) { vtx2level[i_vtx] = UINT_MAX; } // reset for the next search
+    return std::make_pair(i_vtx_far, height);
+  };
+  std::vector<unsigned int> new2old;
+  new2old.reserve(num_vtx);
+  std::vector<unsigned char> vtx2isvisited(num_vtx, 0);
+  std::vector<unsigned int> neighbors;
+  for (unsigned int i_vtx_seed = 0; i_vtx_seed < num_vtx; ++i_vtx_seed) {
+    if (vtx2isvisited[i_vtx_seed]) { continue; }
+    // find a pseudo-peripheral vertex of this component
+    unsigned int i_vtx_start = i_vtx_seed;
+    auto[i_vtx_far, height] = bfs(i_vtx_start);
+    for (unsigned int itr = 0; itr < 8; ++itr) {
+      auto[i_vtx_far1, height1] = bfs(i_vtx_far);
+      if (height1 <= height) { break; }
+      i_vtx_start = i_vtx_far;
+      i_vtx_far = i_vtx_far1;
+      height = height1;
+    }
+    // Cuthill-McKee: visit the neighbors in the ascending order of the degree
+    unsigned int iq = new2old.size();
+    new2old.push_back(i_vtx_start);
+    vtx2isvisited[i_vtx_start] = 1;
+    for (; iq < new2old.size(); ++iq) {
+      const unsigned int i_vtx = new2old[iq];
+      neighbors.clear();
+      for (unsigned int idx = vtx2idx[i_vtx]; idx < vtx2idx[i_vtx + 1]; ++idx) {
+        const unsigned int j_vtx = idx2vtx[idx];
+        if (vtx2isvisited[j_vtx]) { continue; }
+        vtx2isvisited[j_vtx] = 1;
+        neighbors.push_back(j_vtx);
+      }
+      std::stable_sort(neighbors.begin(), neighbors.end(), [&](unsigned int a, unsigned int b) {
+        return vtx2degree[a] < vtx2degree[b];
+      });
+      new2old.insert(new2old.end(), neighbors.begin(), neighbors.end());
+    }
+  }
+  assert(new2old.size() == num_vtx);
+  std::reverse(new2old.begin(), new2old.end());
+  return new2old;
+}
+
+/**
+ * permutation of vertices and its inverse
+ */
+class VertexPermutation {
+ public:
+  VertexPermutation() = default;
+
+  explicit VertexPermutation(std::vector<unsigned int> new2old_)
+      : new2old(std::move(new2old_)) {
+    old2new.resize(new2old.size());
+    for (unsigned int i_new = 0; i_new < new2old.size(); ++i_new) {
+      old2new[new2old[i_new]] = i_new;
+    }
+  }
+
+  /**
+   * renumber the vertex indices of the elements (e.g., tri2vtx, line2vtx) in place
+   */
+  template<typename ELEM2VTX>
+  void renumber_elements(ELEM2VTX &elem2vtx) const {
+    for (int i_elem = 0; i_elem < elem2vtx.rows(); ++i_elem) {
+      for (int i_node = 0; i_node < elem2vtx.cols(); ++i_node) {
+        elem2vtx(i_elem, i_node) = old2new[elem2vtx(i_elem, i_node)];
+      }
+    }
+  }
+
+  /**
+   * reorder the rows of per-vertex values (e.g., vtx2xyz, vtx2isfree) from the original order to the new order
+   */
+  template<typename VTX2VAL>
+  void to_new_order(VTX2VAL &vtx2val) const {
+    assert(static_cast<unsigned int>(vtx2val.rows()) == new2old.size());
+    const VTX2VAL vtx2val_old = vtx2val;
+    for (unsigned int i_new = 0; i_new < new2old.size(); ++i_new) {
+      vtx2val.row(i_new) = vtx2val_old.row(new2old[i_new]);
+    }
+  }
+
+  /**
+   * reorder the rows of per-vertex values from the new order back to the original order
+   */
+  template<typename VTX2VAL>
+  void to_original_order(VTX2VAL &vtx2val) const {
+    assert(static_cast<unsigned int>(vtx2val.rows()) == new2old.size());
+    const VTX2VAL vtx2val_new = vtx2val;
+    for (unsigned int i_new = 0; i_new < new2old.size(); ++i_new) {
+      vtx2val.row(new2old[i_new]) = vtx2val_new.row(i_new);
+    }
+  }
+
+ public:
+  std::vector<unsigned int> new2old;
+  std::vector<unsigned int> old2new;
+};
+
+/**
+ * renumber the vertices of a mesh with the reverse Cuthill-McKee ordering.
+ * The element's connectivity and all the given per-vertex arrays are updated in place.
+ * @param elem2vtx element's connectivity
+ * @param vtx2val0 per-vertex array such as coordinates. Its number of rows gives the number of vertices
+ * @param vtx2vals other per-vertex arrays such as boundary masks
+ * @return permutation that can be used to map the results back to the original order
+ */
+template<typename ELEM2VTX, typename VTX2VAL0, typename... VTX2VAL>
+VertexPermutation reorder_mesh_vertices(
+    ELEM2VTX &elem2vtx,
+    VTX2VAL0 &vtx2val0,
+    VTX2VAL &... vtx2vals) {
+  const unsigned int num_vtx = vtx2val0.rows();
+  assert(((static_cast<unsigned int>(vtx2vals.rows()) == num_vtx) && ...));
+  const auto[vtx2idx, idx2vtx] = pba::vertex_to_vertex_parallel(elem2vtx, num_vtx);
+  const VertexPermutation perm(pba::reverse_cuthill_mckee_ordering(vtx2idx, idx2vtx));
+  perm.renumber_elements(elem2vtx);
+  perm.to_new_order(vtx2val0);
+  (perm.to_new_order(vtx2vals), ...);
+  return perm;
+}
+
+} // namespace pba
+
+#endif //PBA_VERTEX_REORDERING_H_
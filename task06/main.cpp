@@ -6,6 +6,7 @@
 #include <cstdlib>
 #include <iostream>
 #include <vector>
+#include <set>
 #include <cassert>
 #define GL_SILENCE_DEPRECATION
 #include <GLFW/glfw3.h>
@@ -17,6 +18,12 @@
 #include "../src/pba_floor_drawer.h"
 #include "../src/pba_eigen_gl.h"
 #include "../src/pba_block_sparse_matrix.h"
+#include "../src/pba_block_sparse_matrix_batch.h"
+#include "../src/pba_block_sparse_cholesky.h"
+#include "../src/pba_block_sparse_amg.h"
+#include "../src/pba_block_sparse_matrix_padded.h"
+#include "../src/pba_vertex_reordering.h"
+#include "../src/pba_parallel.h"
 
 /**
  * compute the elastic potential energy, its gradient and its hessian of a 3D spring.
@@ -54,6 +61,156 @@ void WdWddW_Spring3(
   ddw[1][0] = -n;
 }
 
+/**
+ * Hessian of the mass-spring system's energy (including the inertia term) applied to a vector
+ * without assembling the matrix. The spring's hessian is evaluated once at the positions given to the constructor,
+ * and only its 3x3 block is stored for each spring. The fixed DoFs are handled in the same way as
+ * `BlockSparseMatrix::set_is_free`.
+ */
+class MassSpringHessianOperator {
+ public:
+  MassSpringHessianOperator(
+      const Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vtx2xyz,
+      const Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vtx2xyz_ini,
+      const Eigen::Matrix<int, Eigen::Dynamic, 2, Eigen::RowMajor> &line2vtx,
+      double stiffness,
+      double mass_point,
+      double dt,
+      const Eigen::MatrixX3d &vtx2isfree)
+      : line2vtx(line2vtx), mass_point(mass_point), dt(dt), vtx2isfree(vtx2isfree) {
+    line2hessian.resize(line2vtx.rows());
+    for (int i_line = 0; i_line < line2vtx.rows(); ++i_line) {
+      const int i_vtx0 = line2vtx(i_line, 0);
+      const int i_vtx1 = line2vtx(i_line, 1);
+      const double length_ini = (vtx2xyz_ini.row(i_vtx0) - vtx2xyz_ini.row(i_vtx1)).norm();
+      const Eigen::Vector3d node2xyz[2] = {
+          vtx2xyz.row(i_vtx0).cast<double>(),
+          vtx2xyz.row(i_vtx1).cast<double>()};
+      double w;
+      Eigen::Vector3d dw[2];
+      Eigen::Matrix3d ddw[2][2];
+      WdWddW_Spring3(
+          w, dw, ddw,
+          node2xyz, length_ini, stiffness);
+      // the energy only depends on the difference of the end points, so ddw[0][0] = ddw[1][1] = -ddw[0][1] = -ddw[1][0]
+      line2hessian[i_line] = ddw[0][0];
+    }
+  }
+
+  void multiply_vector(
+      Eigen::MatrixX3d &y,
+      const Eigen::MatrixX3d &x) const {
+    const Eigen::MatrixX3d x_free = x.cwiseProduct(vtx2isfree);
+    y = x_free * (mass_point / (dt * dt)); // inertia
+    for (int i_line = 0; i_line < line2vtx.rows(); ++i_line) {
+      const int i_vtx0 = line2vtx(i_line, 0);
+      const int i_vtx1 = line2vtx(i_line, 1);
+      const Eigen::Vector3d d = line2hessian[i_line] * (x_free.row(i_vtx0) - x_free.row(i_vtx1)).transpose();
+      y.row(i_vtx0) += d;
+      y.row(i_vtx1) -= d;
+    }
+    y = y.cwiseProduct(vtx2isfree) + x - x_free;
+  }
+
+ private:
+  const Eigen::Matrix<int, Eigen::Dynamic, 2, Eigen::RowMajor> &line2vtx;
+  const double mass_point;
+  const double dt;
+  const Eigen::MatrixX3d &vtx2isfree;
+  std::vector<Eigen::Matrix3d> line2hessian; // 3x3 block of each spring's hessian
+};
+
+/**
+ * linear solver for the hessian of the mass-spring system. The method is chosen once by `Type`, and
+ * the work depending only on the sparsity pattern (e.g., the ordering of the direct solver) is done in `initialize`.
+ * The program stops with an error message if the chosen method fails, instead of falling back to another one.
+ */
+class MassSpringLinearSolver {
+ public:
+  enum class Type {
+    ConjugateGradient, // conjugate gradient method on the assembled matrix
+    MatrixFree, // conjugate gradient method multiplying the hessian without assembling it
+    Direct, // sparse Cholesky factorization. The ordering and the symbolic factorization are computed once
+    AmgPreconditioned, // conjugate gradient method preconditioned by the algebraic multigrid
+    Padded, // conjugate gradient method on the padded layout for the SIMD (AVX2 with the cmake option `PBA_USE_AVX2`)
+    MixedPrecision, // the matrix is stored in float and solved by the mixed-precision conjugate gradient method
+  };
+
+  /**
+   * @param sparse matrix whose pattern is used for all the following solves
+   */
+  void initialize(Type type_, const pba::BlockSparseMatrix<3> &sparse) {
+    type = type_;
+    if (type == Type::Direct) {
+      direct_solver.initialize(sparse);
+    } else if (type == Type::AmgPreconditioned) {
+      amg.initialize(sparse);
+    } else if (type == Type::Padded) {
+      padded.initialize(sparse);
+    } else if (type == Type::MixedPrecision) { // same pattern as the matrix
+      sparse_float.row2idx = sparse.row2idx;
+      sparse_float.idx2col = sparse.idx2col;
+      sparse_float.idx2block.resize(sparse.idx2block.size());
+      sparse_float.is_symmetric = sparse.is_symmetric;
+    }
+  }
+
+  [[nodiscard]] bool is_matrix_free() const { return type == Type::MatrixFree; }
+
+  /**
+   * update the solver (e.g., the numeric factorization) for the current values of the matrix
+   */
+  void set_matrix(const pba::BlockSparseMatrix<3> &sparse) {
+    assert(!is_matrix_free());
+    if (type == Type::Direct) {
+      if (!direct_solver.factorize(sparse)) {
+        std::cout << "Error: the Cholesky factorization failed. The hessian is not positive definite" << std::endl;
+        exit(EXIT_FAILURE);
+      }
+    } else if (type == Type::AmgPreconditioned) {
+      amg.update(sparse); // only the values are recomputed. the hierarchy is reused
+    } else if (type == Type::Padded) {
+      padded.set_value(sparse); // only the values are copied
+    } else if (type == Type::MixedPrecision) {
+      assert(sparse_float.idx2col == sparse.idx2col);
+      for (unsigned int idx = 0; idx < sparse.idx2block.size(); ++idx) {
+        sparse_float.idx2block[idx] = sparse.idx2block[idx].cast<float>();
+      }
+    }
+  }
+
+  /**
+   * @param sparse matrix given to the last `set_matrix`
+   * @param b right hand side
+   * @return solution
+   */
+  Eigen::MatrixX3d solve(
+      const pba::BlockSparseMatrix<3> &sparse,
+      const Eigen::MatrixX3d &b) const {
+    assert(!is_matrix_free());
+    Eigen::MatrixX3d r = b; // residual is stored after the computation
+    if (type == Type::Direct) {
+      return direct_solver.solve(r);
+    } else if (type == Type::AmgPreconditioned) {
+      return sparse.solve_preconditioned_conjugate_gradient(r, amg).first;
+    } else if (type == Type::Padded) {
+      pba::PaddedBlockSparseMatrix3::Vector r_padded = pba::PaddedBlockSparseMatrix3::to_padded(r);
+      return pba::PaddedBlockSparseMatrix3::from_padded(padded.solve_conjugate_gradient(r_padded));
+    } else if (type == Type::MixedPrecision) {
+      return sparse_float.solve_conjugate_gradient_mixed_precision(r);
+    }
+    return sparse.solve_conjugate_gradient(r);
+  }
+
+ public:
+  Type type = Type::ConjugateGradient;
+ private:
+  pba::BlockSparseCholesky<3> direct_solver;
+  pba::BlockSparseAmg<3> amg;
+  pba::PaddedBlockSparseMatrix3 padded;
+  pba::BlockSparseMatrix<3, float> sparse_float;
+};
+
 float step_time_mass_spring_system_with_variational_integration(
     Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vtx2xyz,
     Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vtx2velocity,
@@ -64,11 +221,13 @@ float step_time_mass_spring_system_with_variational_integration(
     const Eigen::Vector3f &gravity,
     const Eigen::MatrixX3d &vtx2isfree,
     float dt,
-    pba::BlockSparseMatrix<3> &sparse) { // simulation
+    pba::BlockSparseMatrix<3> &sparse,
+    MassSpringLinearSolver &solver) { // simulation
+  const bool is_matrix_free = solver.is_matrix_free();
   const unsigned int num_vtx = vtx2xyz.rows(); // number of vertices
   double W = 0.0; // energy of the system
   Eigen::MatrixX3d gradW = Eigen::MatrixX3d::Zero(num_vtx, 3); // gradient of the energy
-  sparse.setZero();
+  if (!is_matrix_free) { sparse.setZero(); }
   // step position using velocity
   vtx2xyz += vtx2velocity * dt;
   for (int i_line = 0; i_line < line2vtx.rows(); ++i_line) { // loop over springs
@@ -92,17 +251,21 @@ float step_time_mass_spring_system_with_variational_integration(
       gradW.row(i_vtx) += dw[i_node];
     }
     // merge hessian
+    if (is_matrix_free) { continue; } // the hessian is not assembled
     for (unsigned int i_node = 0; i_node < 2; ++i_node) {
       for (unsigned int j_node = 0; j_node < 2; ++j_node) {
         const int i_vtx = line2vtx(i_line, i_node);
         const int j_vtx = line2vtx(i_line, j_node);
+        if (sparse.is_symmetric && i_vtx > j_vtx) { continue; } // only upper blocks are stored
         sparse.coeff(i_vtx, j_vtx) += ddw[i_node][j_node];
       }
     }
   }
   // adding the dynamic effect
-  for (unsigned int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) {
-    sparse.coeff(i_vtx, i_vtx) += Eigen::Matrix3d::Identity() * (mass_point / (dt * dt));
+  if (!is_matrix_free) {
+    for (unsigned int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) {
+      sparse.coeff(i_vtx, i_vtx) += Eigen::Matrix3d::Identity() * (mass_point / (dt * dt));
+    }
   }
   // adding gravitational potential energy and its gradient
   for (unsigned int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) {
@@ -111,35 +274,391 @@ float step_time_mass_spring_system_with_variational_integration(
   }
   // set free/fix
   gradW = gradW.cwiseProduct(vtx2isfree);
-  sparse.set_is_free(vtx2isfree);
+  if (!is_matrix_free) { sparse.set_is_free(vtx2isfree); }
   // solve
-  Eigen::MatrixX3d x = sparse.solve_conjugate_gradient(gradW);
+  Eigen::MatrixX3d x;
+  if (is_matrix_free) {
+    const MassSpringHessianOperator hessian(
+        vtx2xyz, vtx2xyz_ini, line2vtx, stiffness, mass_point, dt, vtx2isfree);
+    x = pba::solve_conjugate_gradient(hessian, gradW);
+  } else {
+    solver.set_matrix(sparse);
+    x = solver.solve(sparse, gradW);
+  }
   // step position and velocity
   vtx2velocity += -x.cast<float>() / dt;
   vtx2xyz -= x.cast<float>();
   return static_cast<float>(W);
 }
 
+/**
+ * incremental potential of the implicit Euler time step: the elastic and gravitational energy plus the inertia term
+ * m / (2 dt^2) |x - x_pred|^2. Its gradient and (optionally) hessian are also computed.
+ * @param gradW gradient of the potential. the fixed DoFs are set zero
+ * @param sparse hessian of the potential with the fixed DoFs set by `set_is_free`. not computed if nullptr
+ * @param vtx2xyz positions where the potential is evaluated
+ * @param vtx2xyz_pred predicted positions (x + dt * v)
+ * @return incremental potential
+ */
+double incremental_potential_mass_spring_system(
+    Eigen::MatrixX3d &gradW,
+    pba::BlockSparseMatrix<3> *sparse,
+    const Eigen::MatrixX3d &vtx2xyz,
+    const Eigen::MatrixX3d &vtx2xyz_pred,
+    const Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vtx2xyz_ini,
+    const Eigen::Matrix<int, Eigen::Dynamic, 2, Eigen::RowMajor> &line2vtx,
+    double stiffness,
+    double mass_point,
+    const Eigen::Vector3d &gravity,
+    const Eigen::MatrixX3d &vtx2isfree,
+    double dt) {
+  const unsigned int num_vtx = vtx2xyz.rows();
+  double W = 0.0;
+  gradW = Eigen::MatrixX3d::Zero(num_vtx, 3);
+  if (sparse) { sparse->setZero(); }
+  for (int i_line = 0; i_line < line2vtx.rows(); ++i_line) {
+    const int i_vtx0 = line2vtx(i_line, 0);
+    const int i_vtx1 = line2vtx(i_line, 1);
+    const double length_ini = (vtx2xyz_ini.row(i_vtx0) - vtx2xyz_ini.row(i_vtx1)).norm();
+    const Eigen::Vector3d node2xyz[2] = {vtx2xyz.row(i_vtx0), vtx2xyz.row(i_vtx1)};
+    double w;
+    Eigen::Vector3d dw[2];
+    Eigen::Matrix3d ddw[2][2];
+    WdWddW_Spring3(
+        w, dw, ddw,
+        node2xyz, length_ini, stiffness);
+    W += w;
+    for (unsigned int i_node = 0; i_node < 2; ++i_node) {
+      gradW.row(line2vtx(i_line, i_node)) += dw[i_node];
+    }
+    if (!sparse) { continue; }
+    for (unsigned int i_node = 0; i_node < 2; ++i_node) {
+      for (unsigned int j_node = 0; j_node < 2; ++j_node) {
+        const int i_vtx = line2vtx(i_line, i_node);
+        const int j_vtx = line2vtx(i_line, j_node);
+        if (sparse->is_symmetric && i_vtx > j_vtx) { continue; }
+        sparse->coeff(i_vtx, j_vtx) += ddw[i_node][j_node];
+      }
+    }
+  }
+  const double mass_dt2 = mass_point / (dt * dt);
+  for (unsigned int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) {
+    const Eigen::Vector3d d = (vtx2xyz.row(i_vtx) - vtx2xyz_pred.row(i_vtx)).transpose();
+    W += 0.5 * mass_dt2 * d.squaredNorm() - mass_point * vtx2xyz.row(i_vtx).dot(gravity);
+    gradW.row(i_vtx) += mass_dt2 * d - mass_point * gravity;
+    if (sparse) { sparse->coeff(i_vtx, i_vtx) += Eigen::Matrix3d::Identity() * mass_dt2; }
+  }
+  gradW = gradW.cwiseProduct(vtx2isfree);
+  if (sparse) { sparse->set_is_free(vtx2isfree); }
+  return W;
+}
+
+/**
+ * implicit Euler time step solved by the Newton's method with the backtracking line search on the incremental potential.
+ * The hessian (and the factorization or the preconditioner computed from it) is reused while
+ * the residual decreases faster than `reuse_ratio` per iteration.
+ * When the Newton direction is not a descent direction or the line search fails (e.g., the reused hessian is
+ * too old or the conjugate gradient method stops at its iteration cap), the hessian is re-evaluated, and
+ * then the gradient direction scaled by the inertia is tried. The step is not taken if all of them fail.
+ * @param max_iteration maximum number of the Newton iterations
+ * @param tolerance ratio of the residual's norm to the one at the beginning of the step to stop the iteration
+ * @param reuse_ratio ratio of the residual's norm to the previous one below which the hessian is reused
+ * @return number of the Newton iterations and the number of the hessian evaluations
+ */
+std::pair<unsigned int, unsigned int> step_time_mass_spring_system_with_newton_method(
+    Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vtx2xyz,
+    Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vtx2velocity,
+    const Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vtx2xyz_ini,
+    const Eigen::Matrix<int, Eigen::Dynamic, 2, Eigen::RowMajor> &line2vtx,
+    float stiffness,
+    float mass_point,
+    const Eigen::Vector3f &gravity,
+    const Eigen::MatrixX3d &vtx2isfree,
+    float dt,
+    pba::BlockSparseMatrix<3> &sparse,
+    MassSpringLinearSolver &solver,
+    unsigned int max_iteration = 20,
+    double tolerance = 1.0e-4,
+    double reuse_ratio = 0.25) {
+  if (solver.is_matrix_free()) {
+    std::cout << "Error: the Newton's method needs the assembled hessian. Choose another linear solver" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  const Eigen::MatrixX3d vtx2xyz_pred = (vtx2xyz + vtx2velocity * dt).cast<double>();
+  Eigen::MatrixX3d x = vtx2xyz_pred; // the iteration starts from the prediction
+  Eigen::MatrixX3d gradW, gradW_trial;
+  auto potential = [&](Eigen::MatrixX3d &grad, pba::BlockSparseMatrix<3> *hessian, const Eigen::MatrixX3d &x0) {
+    return incremental_potential_mass_spring_system(
+        grad, hessian, x0, vtx2xyz_pred, vtx2xyz_ini, line2vtx,
+        stiffness, mass_point, gravity.cast<double>(), vtx2isfree, dt);
+  };
+  double W = potential(gradW, &sparse, x);
+  solver.set_matrix(sparse);
+  unsigned int num_hessian = 1;
+  bool is_hessian_current = true; // the hessian is evaluated at x
+  const double residual_ini = gradW.norm();
+  double residual_pre = residual_ini;
+  unsigned int itr = 0;
+  for (; itr < max_iteration; ++itr) {
+    if (residual_pre <= residual_ini * tolerance) { break; }
+    // 0: Newton direction, 1: Newton direction with the hessian re-evaluated (skipped if it is current),
+    // 2: gradient direction scaled by the inertia
+    bool is_accepted = false;
+    for (unsigned int i_direction = 0; i_direction < 3 && !is_accepted; ++i_direction) {
+      if (i_direction == 1) {
+        if (is_hessian_current) { continue; }
+        potential(gradW, &sparse, x);
+        solver.set_matrix(sparse);
+        ++num_hessian;
+        is_hessian_current = true;
+      }
+      const Eigen::MatrixX3d dx = i_direction < 2 ? solver.solve(sparse, gradW) : (gradW * (dt * dt / mass_point)).eval();
+      const double slope = -gradW.cwiseProduct(dx).sum();
+      if (!(slope < 0.)) { continue; } // not a descent direction
+      // backtracking line search with the Armijo condition
+      double alpha = 1.0;
+      double W_trial = potential(gradW_trial, nullptr, x - alpha * dx);
+      for (unsigned int i_search = 0; i_search < 10 && W_trial > W + 1.0e-4 * alpha * slope; ++i_search) {
+        alpha *= 0.5;
+        W_trial = potential(gradW_trial, nullptr, x - alpha * dx);
+      }
+      if (W_trial > W + 1.0e-4 * alpha * slope) { continue; }
+      x -= alpha * dx;
+      W = W_trial;
+      gradW = gradW_trial;
+      is_hessian_current = false;
+      is_accepted = true;
+    }
+    if (!is_accepted) { break; } // no direction decreases the potential (i.e., converged up to the round-off)
+    // the hessian is updated only when the convergence is slow and the iteration continues
+    const double residual = gradW.norm();
+    if (residual > residual_ini * tolerance && residual > residual_pre * reuse_ratio) {
+      potential(gradW, &sparse, x);
+      solver.set_matrix(sparse);
+      ++num_hessian;
+      is_hessian_current = true;
+    }
+    residual_pre = residual;
+  }
+  // step position and velocity
+  const Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> vtx2xyz_new = x.cast<float>();
+  vtx2velocity = (vtx2xyz_new - vtx2xyz) / dt;
+  vtx2xyz = vtx2xyz_new;
+  return {itr, num_hessian};
+}
+
+/**
+ * step many instances of the mass-spring system with the same mesh and different parameters at once.
+ * The instances' positions and velocities are stacked in one array (instance by instance), and
+ * the instances are assembled and solved in parallel with the conjugate gradient method.
+ * @param ins2vtx2xyz positions of all the instances. the rows [i * num_vtx, (i+1) * num_vtx) are the i-th instance's
+ * @param ins2vtx2velocity velocities of all the instances in the same layout as the positions
+ * @param line2idx block indices of the springs (`BlockSparseMatrix::element_to_block_index(line2vtx)`)
+ * @param vtx2idx_dia block indices of the diagonal blocks
+ * @param ins2stiffness stiffness of each instance
+ * @param ins2mass_point mass of a point for each instance
+ * @param ins2gravity gravity of each instance
+ * @param sparse the hessians of the instances
+ * @return energy of each instance
+ */
+std::vector<float> step_time_mass_spring_system_with_variational_integration_batch(
+    Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &ins2vtx2xyz,
+    Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &ins2vtx2velocity,
+    const Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vtx2xyz_ini,
+    const Eigen::Matrix<int, Eigen::Dynamic, 2, Eigen::RowMajor> &line2vtx,
+    const std::vector<unsigned int> &line2idx,
+    const std::vector<unsigned int> &vtx2idx_dia,
+    const std::vector<float> &ins2stiffness,
+    const std::vector<float> &ins2mass_point,
+    const std::vector<Eigen::Vector3f> &ins2gravity,
+    const Eigen::MatrixX3d &vtx2isfree,
+    float dt,
+    pba::BlockSparseMatrixBatch<3> &sparse) {
+  using VTX2XYZ = Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor>;
+  const unsigned int num_vtx = vtx2xyz_ini.rows(); // number of vertices of an instance
+  const unsigned int num_instance = sparse.num_instance;
+  assert(ins2vtx2xyz.rows() == num_instance * num_vtx && ins2vtx2velocity.rows() == num_instance * num_vtx);
+  assert(line2idx.size() == static_cast<size_t>(line2vtx.rows() * 4));
+  assert(vtx2idx_dia.size() == num_vtx);
+  std::vector<double> line2length_ini(line2vtx.rows()); // shared by all the instances
+  for (int i_line = 0; i_line < line2vtx.rows(); ++i_line) {
+    line2length_ini[i_line] = (vtx2xyz_ini.row(line2vtx(i_line, 0)) - vtx2xyz_ini.row(line2vtx(i_line, 1))).norm();
+  }
+  std::vector<float> ins2energy(num_instance);
+  pba::parallel_for(num_instance, [&](unsigned int i_ins_begin, unsigned int i_ins_end) {
+    for (unsigned int i_ins = i_ins_begin; i_ins < i_ins_end; ++i_ins) {
+      Eigen::Map<VTX2XYZ> vtx2xyz(ins2vtx2xyz.data() + i_ins * num_vtx * 3, num_vtx, 3);
+      Eigen::Map<VTX2XYZ> vtx2velocity(ins2vtx2velocity.data() + i_ins * num_vtx * 3, num_vtx, 3);
+      const double stiffness = ins2stiffness[i_ins];
+      const double mass_point = ins2mass_point[i_ins];
+      double W = 0.0; // energy of the system
+      Eigen::MatrixX3d gradW = Eigen::MatrixX3d::Zero(num_vtx, 3); // gradient of the energy
+      sparse.setZero(i_ins);
+      auto *idx2block = sparse.blocks(i_ins);
+      vtx2xyz += vtx2velocity * dt;
+      for (int i_line = 0; i_line < line2vtx.rows(); ++i_line) {
+        const Eigen::Vector3d node2xyz[2] = {
+            vtx2xyz.row(line2vtx(i_line, 0)).cast<double>(),
+            vtx2xyz.row(line2vtx(i_line, 1)).cast<double>()};
+        double w;
+        Eigen::Vector3d dw[2];
+        Eigen::Matrix3d ddw[2][2];
+        WdWddW_Spring3(
+            w, dw, ddw,
+            node2xyz, line2length_ini[i_line], stiffness);
+        W += w;
+        for (unsigned int i_node = 0; i_node < 2; ++i_node) {
+          gradW.row(line2vtx(i_line, i_node)) += dw[i_node];
+          for (unsigned int j_node = 0; j_node < 2; ++j_node) {
+            const unsigned int idx0 = line2idx[i_line * 4 + i_node * 2 + j_node];
+            if (idx0 == pba::BlockSparseMatrix<3>::empty_slot) { continue; } // lower block of the symmetric storage
+            idx2block[idx0] += ddw[i_node][j_node];
+          }
+        }
+      }
+      for (unsigned int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) {
+        idx2block[vtx2idx_dia[i_vtx]] += Eigen::Matrix3d::Identity() * (mass_point / (dt * dt));
+        gradW.row(i_vtx) -= (mass_point * ins2gravity[i_ins]).cast<double>();
+        W -= mass_point * vtx2xyz.row(i_vtx).dot(ins2gravity[i_ins]);
+      }
+      gradW = gradW.cwiseProduct(vtx2isfree);
+      sparse.set_is_free(i_ins, vtx2isfree);
+      const Eigen::MatrixX3d x = pba::solve_conjugate_gradient(sparse.instance(i_ins), gradW);
+      vtx2velocity += -x.cast<float>() / dt;
+      vtx2xyz -= x.cast<float>();
+      ins2energy[i_ins] = static_cast<float>(W);
+    }
+  });
+  return ins2energy;
+}
+
+/**
+ * check the pattern's update of the block sparse matrix (`add_connection` and `remove_connection`).
+ * Connections that are not in the mesh are added, and then some of them and some of the mesh's springs are removed,
+ * which re-allocates the slack, reuses the empty slots and compacts the storage. The matrix-vector product is
+ * compared with the one of the matrix initialized from scratch with the resulting connections and the same values.
+ * @return maximum difference of the products
+ */
+double check_block_sparse_matrix_pattern_update(
+    const Eigen::MatrixXi &tri2vtx,
+    const Eigen::Matrix<int, Eigen::Dynamic, 2, Eigen::RowMajor> &line2vtx,
+    unsigned int num_vtx,
+    bool is_symmetric) {
+  std::set<std::pair<unsigned int, unsigned int> > connections; // (i_vtx, j_vtx) with i_vtx < j_vtx
+  for (int i_line = 0; i_line < line2vtx.rows(); ++i_line) {
+    const unsigned int i_vtx = line2vtx(i_line, 0), j_vtx = line2vtx(i_line, 1);
+    connections.emplace(std::min(i_vtx, j_vtx), std::max(i_vtx, j_vtx));
+  }
+  pba::BlockSparseMatrix<3> sparse_updated;
+  sparse_updated.initialize(tri2vtx, num_vtx, is_symmetric);
+  auto add = [&](unsigned int i_vtx, unsigned int j_vtx) {
+    if (i_vtx == j_vtx) { return; }
+    sparse_updated.add_connection(i_vtx, j_vtx);
+    connections.emplace(std::min(i_vtx, j_vtx), std::max(i_vtx, j_vtx));
+  };
+  auto remove = [&](unsigned int i_vtx, unsigned int j_vtx) {
+    if (i_vtx == j_vtx) { return; }
+    sparse_updated.remove_connection(i_vtx, j_vtx);
+    connections.erase({std::min(i_vtx, j_vtx), std::max(i_vtx, j_vtx)});
+  };
+  for (unsigned int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) { add(i_vtx, (i_vtx * 7 + 13) % num_vtx); }
+  for (unsigned int i_vtx = 0; i_vtx < num_vtx; i_vtx += 2) { remove(i_vtx, (i_vtx * 7 + 13) % num_vtx); }
+  for (int i_line = 0; i_line < line2vtx.rows(); ++i_line) {
+    if (i_line % 3 != 0) { remove(line2vtx(i_line, 0), line2vtx(i_line, 1)); }
+  }
+  for (unsigned int i_vtx = 0; i_vtx < num_vtx; i_vtx += 4) { add(i_vtx, (i_vtx * 5 + 3) % num_vtx); }
+  // matrix initialized with the resulting connections. The diagonal blocks are given as the lines (i_vtx, i_vtx)
+  Eigen::MatrixXi line2vtx_updated(connections.size() + num_vtx, 2);
+  {
+    unsigned int i_line = 0;
+    for (const auto &[i_vtx, j_vtx]: connections) { line2vtx_updated.row(i_line++) << i_vtx, j_vtx; }
+    for (unsigned int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) { line2vtx_updated.row(i_line++) << i_vtx, i_vtx; }
+  }
+  pba::BlockSparseMatrix<3> sparse_initialized;
+  sparse_initialized.initialize(line2vtx_updated, num_vtx, is_symmetric);
+  // the same values in both matrices. The block (j_vtx, i_vtx) is the transpose of the block (i_vtx, j_vtx)
+  auto set_value = [](pba::BlockSparseMatrix<3> &sparse) {
+    for (unsigned int i_row = 0; i_row + 1 < sparse.row2idx.size(); ++i_row) {
+      for (unsigned int idx = sparse.row2idx[i_row]; idx < sparse.row2idx[i_row + 1]; ++idx) {
+        const unsigned int i_col = sparse.idx2col[idx];
+        if (i_col == pba::BlockSparseMatrix<3>::empty_slot) { continue; }
+        const unsigned int i_vtx = std::min(i_row, i_col), j_vtx = std::max(i_row, i_col);
+        Eigen::Matrix3d block;
+        for (int i = 0; i < 9; ++i) { block(i / 3, i % 3) = std::sin(i_vtx * 3. + j_vtx * 7. + i); }
+        if (i_vtx == j_vtx) { block = block + block.transpose() + Eigen::Matrix3d::Identity() * 10.; }
+        sparse.idx2block[idx] = i_row <= i_col ? block : block.transpose();
+      }
+    }
+  };
+  set_value(sparse_updated);
+  set_value(sparse_initialized);
+  const Eigen::MatrixX3d x = Eigen::MatrixX3d::Random(num_vtx, 3);
+  Eigen::MatrixX3d y_updated(num_vtx, 3), y_initialized(num_vtx, 3);
+  sparse_updated.multiply_vector(y_updated, x);
+  sparse_initialized.multiply_vector(y_initialized, x);
+  return (y_updated - y_initialized).cwiseAbs().maxCoeff();
+}
+
 int main() {
   // make geometry
   constexpr int num_theta = 64;
-  const auto[tri2vtx, vtx2xyz_ini] = pba::generate_mesh_annulus3(0.3, 0.8, 32, num_theta);
-  const auto line2vtx = pba::lines_of_mesh(tri2vtx, static_cast<int>(vtx2xyz_ini.rows()));
+  auto[tri2vtx, vtx2xyz_ini] = pba::generate_mesh_annulus3(0.3, 0.8, 32, num_theta);
+
+  // specify free DoF and fixed DoF
+  Eigen::MatrixX3d vtx2isfree = Eigen::MatrixX3d::Ones(vtx2xyz_ini.rows(), 3);
+  for (int i = 0; i < num_theta; ++i) {
+    vtx2isfree.row(i) = Eigen::Vector3d(0., 0., 0);
+  }
+
+  // renumber the vertices to reduce the bandwidth of the matrix for cache efficiency
+  pba::reorder_mesh_vertices(tri2vtx, vtx2xyz_ini, vtx2isfree);
+
+  const auto line2vtx = pba::lines_of_mesh_parallel(tri2vtx, static_cast<int>(vtx2xyz_ini.rows()));
   auto vtx2xyz = vtx2xyz_ini;
 
   // initialize velocity
   Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> vtx2velocity(vtx2xyz.rows(), 3);
   vtx2velocity.setZero();
 
-  // specify free DoF and fixed DoF
-  Eigen::MatrixX3d vtx2isfree = Eigen::MatrixX3d::Ones(vtx2xyz.rows(), 3);
-  for (int i = 0; i < num_theta; ++i) {
-    vtx2isfree.row(i) = Eigen::Vector3d(0., 0., 0);
+  // check the pattern's update used when the springs change during the simulation
+  for (bool is_symmetric: {true, false}) {
+    const double diff = check_block_sparse_matrix_pattern_update(tri2vtx, line2vtx, vtx2xyz.rows(), is_symmetric);
+    if (diff > 1.0e-10) {
+      std::cout << "Error: the pattern's update of the block sparse matrix is wrong: " << diff << std::endl;
+      exit(EXIT_FAILURE);
+    }
   }
 
-  // block sparse matrix
+  // block sparse matrix (the hessian is symmetric so only the upper blocks are stored)
   pba::BlockSparseMatrix<3> sparse_matrix;
-  sparse_matrix.initialize(tri2vtx, vtx2xyz.rows());
+  sparse_matrix.initialize(tri2vtx, vtx2xyz.rows(), true);
+
+  // linear solver of the hessian. See `MassSpringLinearSolver::Type` for the choices
+  constexpr auto linear_solver_type = MassSpringLinearSolver::Type::ConjugateGradient;
+  MassSpringLinearSolver linear_solver;
+  linear_solver.initialize(linear_solver_type, sparse_matrix);
+
+  // solve each time step with the Newton's method instead of one linearization
+  constexpr bool use_newton_method = false;
+
+  // simulate many instances with different stiffness at once. The first instance is drawn
+  constexpr unsigned int num_instance_batch = 0;
+  pba::BlockSparseMatrixBatch<3> sparse_batch;
+  std::vector<unsigned int> line2idx, vtx2idx_dia; // indices of the blocks. The pattern is shared by the instances
+  if (num_instance_batch > 0) {
+    sparse_batch.initialize(sparse_matrix, num_instance_batch);
+    line2idx = sparse_matrix.element_to_block_index(line2vtx);
+    vtx2idx_dia.resize(vtx2xyz.rows());
+    for (unsigned int i_vtx = 0; i_vtx < vtx2idx_dia.size(); ++i_vtx) {
+      vtx2idx_dia[i_vtx] = sparse_matrix.block_index(i_vtx, i_vtx);
+    }
+  }
+  Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> ins2vtx2xyz = vtx2xyz.replicate(num_instance_batch, 1);
+  Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> ins2vtx2velocity = vtx2velocity.replicate(num_instance_batch, 1);
+  std::vector<float> ins2stiffness(num_instance_batch);
+  for (unsigned int i_ins = 0; i_ins < num_instance_batch; ++i_ins) { ins2stiffness[i_ins] = 60.f * (1.f + 0.1f * i_ins); }
+  const std::vector<float> ins2mass_point(num_instance_batch, 1.f);
+  const std::vector<Eigen::Vector3f> ins2gravity(num_instance_batch, {0., -0.1, 0.});
 
   GLFWwindow *window = pba::window_initialization("task06: dynamic mass-spring system using variational Euler time integration");
   pba::FloorDrawer floor(1.0, -1.5);
@@ -152,10 +671,24 @@ int main() {
 
   while (!::glfwWindowShouldClose(window)) {
 
-    if(current_time < 40.0) {
+    if (num_instance_batch > 0 && current_time < 40.0) {
+      const std::vector<float> ins2W = step_time_mass_spring_system_with_variational_integration_batch(
+          ins2vtx2xyz, ins2vtx2velocity, vtx2xyz_ini, line2vtx, line2idx, vtx2idx_dia,
+          ins2stiffness, ins2mass_point, ins2gravity, vtx2isfree, dt, sparse_batch);
+      vtx2xyz = ins2vtx2xyz.topRows(vtx2xyz.rows());
+      current_time += dt;
+      std::cout << "time: " << current_time << "   elastic_energy: " << ins2W[0] << std::endl;
+    } else if (use_newton_method && current_time < 40.0) {
+      const auto[num_newton, num_hessian] = step_time_mass_spring_system_with_newton_method(
+          vtx2xyz, vtx2velocity, vtx2xyz_ini, line2vtx, 60.f, 1.f, {0., -0.1, 0}, vtx2isfree, dt,
+          sparse_matrix, linear_solver);
+      current_time += dt;
+      std::cout << "time: " << current_time << "   newton_iterations: " << num_newton
+                << "   hessian_evaluations: " << num_hessian << std::endl;
+    } else if(current_time < 40.0) {
       float W = step_time_mass_spring_system_with_variational_integration(
           vtx2xyz, vtx2velocity, vtx2xyz_ini, line2vtx, 60.f, 1.f, {0., -0.1, 0}, vtx2isfree, dt,
-          sparse_matrix);
+          sparse_matrix, linear_solver);
       current_time += dt;
       std::cout << "time: " << current_time << "   elastic_energy: " << W << std::endl;
     }
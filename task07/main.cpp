@@ -8,12 +8,16 @@
 #include <vector>
 #include <cassert>
 #include <random>
+#include <filesystem>
+#include <tuple>
 #define GL_SILENCE_DEPRECATION
 #include <GLFW/glfw3.h>
 #include <Eigen/Dense>
 
 #include "../src/pba_util_glfw.h"
 #include "../src/pba_util_gl.h"
+#include "../src/pba_grid_laplace.h"
+#include "../src/pba_mesh_laplace.h"
 
 void solve_laplace_gauss_seidel_on_grid(
     std::vector<float> &vtx2val,
@@ -72,13 +76,119 @@ int main() {
     }
   }
 
+  // 0: Gauss-Seidel method above, 1: red-black Gauss-Seidel method in parallel, 2: geometric multigrid method,
+  // 3: red-black SOR with the estimated optimal relaxation factor, 4: Chebyshev-accelerated Jacobi method,
+  // 5: four red-black Gauss-Seidel sweeps per frame with the temporal cache blocking,
+  // 6: fast Poisson solver with the capacitance matrix method (solved once before the loop),
+  // 7: Gauss-Seidel method only for the cells still changing, with the energy updated incrementally
+  // 8: multicolor Gauss-Seidel method for the unstructured mesh, applied to the edges of the grid
+  // 9: multicolor Gauss-Seidel method on the triangle mesh of the bunny (task08's OBJ file) instead of the grid
+  constexpr int solver_type = 0;
+  pba::GridLaplaceRedBlack red_black;
+  red_black.initialize(grid_size, vtx2isfix);
+  pba::GridLaplaceMultigrid multigrid;
+  if (solver_type == 2) { multigrid.initialize(grid_size, vtx2isfix); }
+  pba::GridLaplaceRedBlack sor;
+  if (solver_type == 3) {
+    sor.initialize(grid_size, vtx2isfix);
+    sor.set_optimal_relaxation_factor();
+  }
+  pba::GridLaplaceChebyshevJacobi chebyshev;
+  if (solver_type == 4) { chebyshev.initialize(grid_size, vtx2isfix); }
+  if (solver_type == 6) {
+    pba::GridLaplaceFastPoisson fast_poisson;
+    fast_poisson.initialize(grid_size, vtx2isfix);
+    const unsigned int num_itr = fast_poisson.solve(vtx2val);
+    std::cout << "capacitance system solved in " << num_itr << " iterations" << std::endl;
+  }
+  pba::GridLaplaceActiveSet active_set;
+  if (solver_type == 7) { active_set.initialize(grid_size, vtx2isfix, vtx2val); }
+  pba::MeshLaplaceMulticolor mesh_laplace;
+  if (solver_type == 8) {
+    // the graph Laplacian of the grid's edges is the same as the 5-point stencil
+    Eigen::MatrixXi line2vtx(2 * grid_size * (grid_size - 1), 2);
+    unsigned int i_line = 0;
+    for (unsigned int iy = 0; iy < grid_size; ++iy) {
+      for (unsigned int ix = 0; ix < grid_size - 1; ++ix) {
+        line2vtx.row(i_line++) << iy * grid_size + ix, iy * grid_size + ix + 1;
+        line2vtx.row(i_line++) << ix * grid_size + iy, (ix + 1) * grid_size + iy;
+      }
+    }
+    mesh_laplace.initialize(line2vtx, grid_size * grid_size, vtx2isfix);
+    std::cout << "number of colors: " << mesh_laplace.num_color() << std::endl;
+  }
+  // bunny seen from the front (the z-axis is up in the OBJ file). The values at the bottom and the ears are fixed
+  Eigen::Matrix<int, Eigen::Dynamic, 3, Eigen::RowMajor> tri2vtx;
+  Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> vtx2xyz;
+  Eigen::Matrix<int, Eigen::Dynamic, 2, Eigen::RowMajor> line2vtx_mesh;
+  std::vector<float> vtx2val_mesh;
+  if (solver_type == 9) {
+    std::tie(tri2vtx, vtx2xyz) = pba::load_wavefront_obj(
+        std::filesystem::path(PATH_SOURCE_DIR) / ".." / "task08" / "bunny_1k.obj");
+    const unsigned int num_vtx = vtx2xyz.rows();
+    const Eigen::RowVector3f xyz_min = vtx2xyz.colwise().minCoeff();
+    const Eigen::RowVector3f xyz_max = vtx2xyz.colwise().maxCoeff();
+    vtx2xyz.rowwise() -= (xyz_min + xyz_max) * 0.5f; // center-ize
+    vtx2xyz *= box_size * 0.9f / (xyz_max - xyz_min).maxCoeff(); // fit in the box
+    const float z_min = vtx2xyz.col(2).minCoeff();
+    const float z_max = vtx2xyz.col(2).maxCoeff();
+    std::vector<bool> vtx2isfix_mesh(num_vtx, false);
+    vtx2val_mesh.resize(num_vtx);
+    std::mt19937 rand(std::random_device{}());
+    std::uniform_real_distribution<float> dist01(0.f, 1.f);
+    for (unsigned int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) {
+      vtx2val_mesh[i_vtx] = dist01(rand);
+      if (vtx2xyz(i_vtx, 2) < z_min + (z_max - z_min) * 0.05f) {
+        vtx2isfix_mesh[i_vtx] = true;
+        vtx2val_mesh[i_vtx] = 0.0;
+      } else if (vtx2xyz(i_vtx, 2) > z_max - (z_max - z_min) * 0.05f) {
+        vtx2isfix_mesh[i_vtx] = true;
+        vtx2val_mesh[i_vtx] = 0.9;
+      }
+    }
+    line2vtx_mesh = pba::lines_of_mesh_parallel(tri2vtx, static_cast<int>(num_vtx));
+    mesh_laplace.initialize(tri2vtx, num_vtx, vtx2isfix_mesh);
+    std::cout << "number of vertices: " << num_vtx << "   number of colors: " << mesh_laplace.num_color() << std::endl;
+  }
+
   while (!::glfwWindowShouldClose(window)) {
     pba::default_window_2d(window);
 
-    solve_laplace_gauss_seidel_on_grid(
-        vtx2val, grid_size, vtx2isfix);
+    if constexpr (solver_type == 1) {
+      red_black.sweep(vtx2val);
+    } else if constexpr (solver_type == 2) {
+      multigrid.cycle(vtx2val);
+    } else if constexpr (solver_type == 3) {
+      sor.sweep(vtx2val);
+    } else if constexpr (solver_type == 4) {
+      chebyshev.iterate(vtx2val);
+    } else if constexpr (solver_type == 5) {
+      red_black.sweep_temporal_blocking(vtx2val, 4);
+    } else if constexpr (solver_type == 6) {
+      // already solved
+    } else if constexpr (solver_type == 7) {
+      active_set.sweep(vtx2val);
+    } else if constexpr (solver_type == 8) {
+      mesh_laplace.sweep(vtx2val);
+    } else if constexpr (solver_type == 9) {
+      mesh_laplace.sweep(vtx2val_mesh);
+    } else {
+      solve_laplace_gauss_seidel_on_grid(
+          vtx2val, grid_size, vtx2isfix);
+    }
 
-    { // compute energy
+    if constexpr (solver_type == 7) { // energy is updated in the sweep
+      std::cout << "Dirichlet's Energy: " << active_set.energy;
+      std::cout << "   active cells: " << active_set.num_active() << std::endl;
+    } else if constexpr (solver_type == 9) { // energy of the mesh's edges
+      float w = 0.f;
+      for (unsigned int i_line = 0; i_line < line2vtx_mesh.rows(); ++i_line) {
+        const float d = vtx2val_mesh[line2vtx_mesh(i_line, 0)] - vtx2val_mesh[line2vtx_mesh(i_line, 1)];
+        w += 0.5f * d * d;
+      }
+      std::cout << "Dirichlet's Energy: " << w;
+      std::cout << "   residual: " << mesh_laplace.residual_norm(vtx2val_mesh) << std::endl;
+    } else { // compute energy
       float w = 0.f;
       for (unsigned int iy = 0; iy < grid_size - 1; ++iy) {
         for (unsigned int ix = 0; ix < grid_size; ++ix) {
@@ -94,10 +204,22 @@ int main() {
           w += 0.5f * (val - val_right) * (val - val_right);
         }
       }
-      std::cout << "Dirichlet's Energy: " << w << std::endl;
+      std::cout << "Dirichlet's Energy: " << w;
+      if (solver_type != 0) { std::cout << "   residual: " << red_black.residual_norm(vtx2val); }
+      std::cout << std::endl;
     }
 
-    {
+    if constexpr (solver_type == 9) {
+      ::glBegin(GL_TRIANGLES);
+      for (unsigned int i_tri = 0; i_tri < tri2vtx.rows(); ++i_tri) {
+        for (unsigned int i_node = 0; i_node < 3; ++i_node) {
+          const int i_vtx = tri2vtx(i_tri, i_node);
+          pba::colormap_hot(vtx2val_mesh[i_vtx], 1.0);
+          ::glVertex2f(vtx2xyz(i_vtx, 0), vtx2xyz(i_vtx, 2));
+        }
+      }
+      ::glEnd();
+    } else {
       const float h = box_size / static_cast<float>(grid_size - 1);
       const float scale = 1.0;
       ::glColor3f(0.9f, 0.9f, 0.9f);
@@ -8,6 +8,7 @@
 #include <vector>
 #include <cassert>
 #include <filesystem>
+#include <tuple>
 #define GL_SILENCE_DEPRECATION
 #include <GLFW/glfw3.h>
 #include <Eigen/Dense>
@@ -17,6 +18,10 @@
 #include "../src/pba_floor_drawer.h"
 #include "../src/pba_eigen_gl.h"
 #include "../src/pba_util_eigen.h"
+#include "../src/pba_parallel.h"
+#include "../src/pba_block_sparse_matrix.h"
+#include "../src/pba_block_sparse_cholesky.h"
+#include "../src/pba_sparse_constraint.h"
 
 #ifndef M_PI
   #define M_PI 3.14159265358979323846264338327950288
@@ -178,9 +183,285 @@ void inflate(
   std::cout << "   lambda (make sure this number converges): " << lambda << std::endl;
 }
 
+/**
+ * add the constraint that the volume enclosed by the triangles equals the target
+ * @param tri2vtx triangles of a closed surface (e.g., the whole mesh or one of its parts)
+ * @return current volume
+ */
+double add_volume_constraint(
+    pba::SparseConstraintJacobian &constraints,
+    const Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vtx2xyz,
+    const Eigen::Matrix<int, Eigen::Dynamic, 3, Eigen::RowMajor> &tri2vtx,
+    double volume_trg) {
+  const unsigned int i_con = constraints.add_constraint(0.);
+  double volume = 0.0;
+  for (unsigned int i_tri = 0; i_tri < tri2vtx.rows(); ++i_tri) {
+    const Eigen::Vector3d node2xyz[3] = {
+        vtx2xyz.row(tri2vtx(i_tri, 0)).cast<double>(),
+        vtx2xyz.row(tri2vtx(i_tri, 1)).cast<double>(),
+        vtx2xyz.row(tri2vtx(i_tri, 2)).cast<double>()};
+    double w = 0.0;
+    Eigen::Vector3d dw[3];
+    wdw_volume_tri_origin(
+        w, dw,
+        node2xyz);
+    volume += w;
+    for (unsigned int inode = 0; inode < 3; ++inode) {
+      constraints.add_gradient(tri2vtx(i_tri, inode), dw[inode]);
+    }
+  }
+  constraints.con2value[i_con] = volume - volume_trg;
+  return volume;
+}
+
+/**
+ * add three constraints that the vertex is at the target position
+ */
+void add_fixed_point_constraint(
+    pba::SparseConstraintJacobian &constraints,
+    const Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vtx2xyz,
+    unsigned int i_vtx,
+    const Eigen::Vector3d &xyz_trg) {
+  for (unsigned int idim = 0; idim < 3; ++idim) {
+    constraints.add_constraint(vtx2xyz(i_vtx, idim) - xyz_trg(idim));
+    constraints.add_gradient(i_vtx, Eigen::Vector3d::Unit(idim));
+  }
+}
+
+/**
+ * add three constraints that the average of the vertices' coordinates is at the target position
+ */
+void add_center_constraint(
+    pba::SparseConstraintJacobian &constraints,
+    const Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vtx2xyz,
+    const Eigen::Vector3d &center_trg) {
+  const unsigned int num_vtx = vtx2xyz.rows();
+  const Eigen::Vector3d center = vtx2xyz.cast<double>().colwise().mean();
+  for (unsigned int idim = 0; idim < 3; ++idim) {
+    constraints.add_constraint(center(idim) - center_trg(idim));
+    for (unsigned int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) {
+      constraints.add_gradient(i_vtx, Eigen::Vector3d::Unit(idim) / num_vtx);
+    }
+  }
+}
+
+/**
+ * precomputed data to assemble the hessian of the springs and the gradients in parallel.
+ * The springs are colored such that the springs of one color share no vertex, so their blocks and gradients are
+ * scattered in parallel through the precomputed indices of the blocks. The volume's gradient is gathered for each
+ * vertex from its triangles. The sums of the energy and the volume are deterministic (see `pba::parallel_reduce_sum`).
+ */
+class InflateParallelAssembly {
+ public:
+  void initialize(
+      const Eigen::Matrix<int, Eigen::Dynamic, 3, Eigen::RowMajor> &tri2vtx,
+      const Eigen::Matrix<int, Eigen::Dynamic, 2, Eigen::RowMajor> &line2vtx,
+      unsigned int num_vtx,
+      const pba::BlockSparseMatrix<3> &sparse) {
+    line2idx = sparse.element_to_block_index(line2vtx);
+    std::tie(color2jdx, jdx2line) = pba::greedy_element_coloring(line2vtx, num_vtx);
+    std::tie(vtx2kdx, kdx2tri) = pba::vertex_to_elem(tri2vtx, num_vtx);
+  }
+
+  /**
+   * add the hessian and the gradient of the springs
+   * @return elastic energy
+   */
+  double assemble_springs(
+      pba::BlockSparseMatrix<3> &sparse,
+      Eigen::MatrixX3d &gradW,
+      const Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vtx2xyz,
+      const Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vtx2xyz_ini,
+      const Eigen::Matrix<int, Eigen::Dynamic, 2, Eigen::RowMajor> &line2vtx,
+      double stiffness) const {
+    double elastic_energy = 0.0;
+    for (unsigned int i_color = 0; i_color < color2jdx.size() - 1; ++i_color) {
+      const unsigned int jdx0 = color2jdx[i_color];
+      elastic_energy += pba::parallel_reduce_sum(color2jdx[i_color + 1] - jdx0, 0., [&](unsigned int i_begin, unsigned int i_end) {
+        double energy = 0.0;
+        for (unsigned int jdx = jdx0 + i_begin; jdx < jdx0 + i_end; ++jdx) {
+          const unsigned int i_line = jdx2line[jdx];
+          const int node2vtx[2] = {
+              line2vtx(i_line, 0),
+              line2vtx(i_line, 1)};
+          float length_ini = (vtx2xyz_ini.row(node2vtx[0]) - vtx2xyz_ini.row(node2vtx[1])).norm();
+          const Eigen::Vector3d node2xyz[2] = {
+              vtx2xyz.row(node2vtx[0]).cast<double>(),
+              vtx2xyz.row(node2vtx[1]).cast<double>()};
+          double w = 0;
+          Eigen::Vector3d dw[2];
+          Eigen::Matrix3d ddw[2][2];
+          wdwddw_spring(w, dw, ddw,
+                        node2xyz, length_ini, stiffness);
+          energy += w;
+          for (unsigned int inode = 0; inode < 2; ++inode) {
+            for (unsigned int jnode = 0; jnode < 2; ++jnode) {
+              const unsigned int idx = line2idx[(i_line * 2 + inode) * 2 + jnode];
+              if (idx == pba::BlockSparseMatrix<3>::empty_slot) { continue; } // lower block in the symmetric storage
+              sparse.idx2block[idx] += ddw[inode][jnode];
+            }
+            gradW.row(node2vtx[inode]) += dw[inode];
+          }
+        }
+        return energy;
+      });
+    }
+    return elastic_energy;
+  }
+
+  /**
+   * same as `add_volume_constraint`, but the gradient is gathered for each vertex in parallel
+   * @return current volume
+   */
+  double add_volume_constraint(
+      pba::SparseConstraintJacobian &constraints,
+      const Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vtx2xyz,
+      const Eigen::Matrix<int, Eigen::Dynamic, 3, Eigen::RowMajor> &tri2vtx,
+      double volume_trg) const {
+    const unsigned int num_tri = tri2vtx.rows();
+    const unsigned int num_vtx = vtx2xyz.rows();
+    std::vector<Eigen::Vector3d> tri2dw(num_tri * 3);
+    const double volume = pba::parallel_reduce_sum(num_tri, 0., [&](unsigned int i_tri_begin, unsigned int i_tri_end) {
+      double sum = 0.0;
+      for (unsigned int i_tri = i_tri_begin; i_tri < i_tri_end; ++i_tri) {
+        const Eigen::Vector3d node2xyz[3] = {
+            vtx2xyz.row(tri2vtx(i_tri, 0)).cast<double>(),
+            vtx2xyz.row(tri2vtx(i_tri, 1)).cast<double>(),
+            vtx2xyz.row(tri2vtx(i_tri, 2)).cast<double>()};
+        double w = 0.0;
+        wdw_volume_tri_origin(
+            w, tri2dw.data() + i_tri * 3,
+            node2xyz);
+        sum += w;
+      }
+      return sum;
+    });
+    std::vector<Eigen::Vector3d> vtx2dw(num_vtx);
+    pba::parallel_for(num_vtx, [&](unsigned int i_vtx_begin, unsigned int i_vtx_end) {
+      for (unsigned int i_vtx = i_vtx_begin; i_vtx < i_vtx_end; ++i_vtx) {
+        Eigen::Vector3d dw = Eigen::Vector3d::Zero();
+        for (unsigned int kdx = vtx2kdx[i_vtx]; kdx < vtx2kdx[i_vtx + 1]; ++kdx) {
+          const unsigned int i_tri = kdx2tri[kdx];
+          for (unsigned int inode = 0; inode < 3; ++inode) {
+            if (static_cast<unsigned int>(tri2vtx(i_tri, inode)) == i_vtx) { dw += tri2dw[i_tri * 3 + inode]; }
+          }
+        }
+        vtx2dw[i_vtx] = dw;
+      }
+    });
+    constraints.add_constraint(volume - volume_trg);
+    for (unsigned int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) {
+      if (vtx2kdx[i_vtx] == vtx2kdx[i_vtx + 1]) { continue; } // not a vertex of the triangles
+      constraints.add_gradient(i_vtx, vtx2dw[i_vtx]);
+    }
+    return volume;
+  }
+
+ private:
+  std::vector<unsigned int> line2idx; // see `pba::BlockSparseMatrix::element_to_block_index`
+  std::vector<unsigned int> color2jdx; // springs of each color
+  std::vector<unsigned int> jdx2line;
+  std::vector<unsigned int> vtx2kdx; // triangles around each vertex
+  std::vector<unsigned int> kdx2tri;
+};
+
+/**
+ * same as `inflate` but the linear system is solved without the dense matrix, with any number of constraints.
+ * The hessian of the springs with the damping (K) is stored in the block sparse matrix and factorized once.
+ * The constraints' Jacobian is sparse and the KKT system is solved with the Schur complement on K
+ * (see `pba::solve_kkt_with_schur_complement`), so the cost grows with the non-zero entries of the Jacobian.
+ * Unlike `inflate`, only K is damped. Damping the multipliers makes the Schur complement nearly singular
+ * for the fixed points, whose J K^{-1} J^T is a diagonal block of K^{-1}.
+ * @param con2lambda Lagrange multipliers. The first one is for the volume
+ * @param constraints Jacobian of the constraints. It is cleared and re-assembled here, so its memory is reused
+ * @param sparse block sparse matrix whose pattern is set from the mesh's lines
+ * @param direct_solver sparse direct solver initialized with `sparse`
+ * @param center_trg if not null, the center of the vertices is also constrained at this position
+ * @param fix2vtx if not null, these vertices are also constrained at their initial positions
+ * @param assembly if not null, the hessian and the gradients are assembled in parallel
+ */
+void inflate_sparse(
+    Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vtx2xyz,
+    Eigen::VectorXd &con2lambda,
+    double volume_trg,
+    const Eigen::Matrix<int, Eigen::Dynamic, 3, Eigen::RowMajor> &tri2vtx,
+    const Eigen::Matrix<int, Eigen::Dynamic, 2, Eigen::RowMajor> &line2vtx,
+    const Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vtx2xyz_ini,
+    pba::SparseConstraintJacobian &constraints,
+    pba::BlockSparseMatrix<3> &sparse,
+    pba::BlockSparseCholesky<3> &direct_solver,
+    const Eigen::Vector3d *center_trg = nullptr,
+    const std::vector<unsigned int> *fix2vtx = nullptr,
+    const InflateParallelAssembly *assembly = nullptr) {
+  const double stiffness = 1.0;
+  const double damping = 0.1;
+  const unsigned int num_vtx = vtx2xyz.rows();
+  sparse.setZero();
+  Eigen::MatrixX3d gradW = Eigen::MatrixX3d::Zero(num_vtx, 3); // gradient of the Lagrangian
+  double elastic_energy = 0.0;
+  if (assembly) {
+    elastic_energy = assembly->assemble_springs(sparse, gradW, vtx2xyz, vtx2xyz_ini, line2vtx, stiffness);
+  } else {
+    for (unsigned int i_line = 0; i_line < line2vtx.rows(); ++i_line) {
+      const int node2vtx[2] = {
+          line2vtx(i_line, 0),
+          line2vtx(i_line, 1)};
+      float length_ini = (vtx2xyz_ini.row(node2vtx[0]) - vtx2xyz_ini.row(node2vtx[1])).norm();
+      const Eigen::Vector3d node2xyz[2] = {
+          vtx2xyz.row(node2vtx[0]).cast<double>(),
+          vtx2xyz.row(node2vtx[1]).cast<double>()};
+      double w = 0;
+      Eigen::Vector3d dw[2];
+      Eigen::Matrix3d ddw[2][2];
+      wdwddw_spring(w, dw, ddw,
+                    node2xyz, length_ini, stiffness);
+      elastic_energy += w;
+      for (unsigned int inode = 0; inode < 2; ++inode) {
+        for (unsigned int jnode = 0; jnode < 2; ++jnode) {
+          if (sparse.is_symmetric && node2vtx[inode] > node2vtx[jnode]) { continue; } // only upper blocks are stored
+          sparse.coeff(node2vtx[inode], node2vtx[jnode]) += ddw[inode][jnode];
+        }
+        gradW.row(node2vtx[inode]) += dw[inode];
+      }
+    }
+  }
+  // setting constraints
+  constraints.clear();
+  const double volume = assembly ?
+                        assembly->add_volume_constraint(constraints, vtx2xyz, tri2vtx, volume_trg) :
+                        add_volume_constraint(constraints, vtx2xyz, tri2vtx, volume_trg);
+  if (center_trg) { add_center_constraint(constraints, vtx2xyz, *center_trg); }
+  if (fix2vtx) {
+    for (unsigned int i_vtx: *fix2vtx) {
+      add_fixed_point_constraint(constraints, vtx2xyz, i_vtx, vtx2xyz_ini.row(i_vtx).transpose().cast<double>());
+    }
+  }
+  if (con2lambda.size() != constraints.num_constraint()) {
+    con2lambda = Eigen::VectorXd::Zero(constraints.num_constraint());
+  }
+  constraints.add_transpose_multiply(gradW, con2lambda);
+  const Eigen::VectorXd con2value = constraints.values();
+  // damping for stable convergence
+  for (unsigned int i_vtx = 0; i_vtx < num_vtx; ++i_vtx) {
+    sparse.coeff(i_vtx, i_vtx) += Eigen::Matrix3d::Identity() * damping;
+  }
+  std::cout << "   elastic_energy (write down in the README.md): " << elastic_energy << std::endl;
+  std::cout << "   current volume: " << volume << "  target volume: " << volume_trg << std::endl;
+  std::cout << "   residual (make sure this number get smaller in each iteration): "
+            << gradW.squaredNorm() + con2value.squaredNorm() << std::endl;
+  // solve the KKT system
+  [[maybe_unused]] const bool is_factorized = direct_solver.factorize(sparse);
+  assert(is_factorized);
+  const auto[upd, dlambda] = pba::solve_kkt_with_schur_complement(
+      direct_solver, constraints, gradW, con2value);
+  vtx2xyz -= upd.cast<float>();
+  con2lambda -= dlambda;
+  std::cout << "   lambda (make sure this number converges): " << con2lambda(0) << std::endl;
+}
+
 int main() {
   const auto[tri2vtx, vtx2xyz_ini] = load_my_bunny();
-  const auto line2vtx = pba::lines_of_mesh(tri2vtx, static_cast<int>(vtx2xyz_ini.rows()));
+  const auto line2vtx = pba::lines_of_mesh_parallel(tri2vtx, static_cast<int>(vtx2xyz_ini.rows()));
   auto vtx2xyz = vtx2xyz_ini;
 
   double volume_ini = 0.0;
@@ -199,9 +480,43 @@ int main() {
   const double volume_trg = volume_ini * 2.0;
   double lambda = 0.0;
 
+  // solve the linear system with the sparse matrix instead of the dense matrix
+  constexpr bool use_sparse_solver = false;
+  // with the sparse solver, also keep the center of the vertices at the initial position
+  constexpr bool fix_center = false;
+  // with the sparse solver, also pin the vertices at the bottom of the bunny to their initial positions
+  constexpr bool fix_bottom = false;
+  // with the sparse solver, assemble the hessian and the gradients in parallel
+  constexpr bool use_parallel_assembly = false;
+  InflateParallelAssembly assembly;
+  const Eigen::Vector3d center_ini = vtx2xyz_ini.cast<double>().colwise().mean();
+  std::vector<unsigned int> fix2vtx;
+  {
+    const float y_min = vtx2xyz_ini.col(1).minCoeff();
+    const float height = vtx2xyz_ini.col(1).maxCoeff() - y_min;
+    for (unsigned int i_vtx = 0; i_vtx < vtx2xyz_ini.rows(); ++i_vtx) {
+      if (vtx2xyz_ini(i_vtx, 1) < y_min + height * 0.02f) { fix2vtx.push_back(i_vtx); }
+    }
+  }
+  Eigen::VectorXd con2lambda;
+  pba::SparseConstraintJacobian constraints;
+  pba::BlockSparseMatrix<3> sparse_matrix;
+  pba::BlockSparseCholesky<3> direct_solver;
+  if (use_sparse_solver) {
+    sparse_matrix.initialize(line2vtx, vtx2xyz.rows(), true);
+    direct_solver.initialize(sparse_matrix);
+    if (use_parallel_assembly) { assembly.initialize(tri2vtx, line2vtx, vtx2xyz.rows(), sparse_matrix); }
+  }
+
   for(unsigned int itr=0;itr<10;++itr){
     std::cout << "iteration: " << itr << std::endl;
-    inflate(vtx2xyz, lambda, volume_trg, tri2vtx, line2vtx, vtx2xyz_ini);
+    if (use_sparse_solver) {
+      inflate_sparse(vtx2xyz, con2lambda, volume_trg, tri2vtx, line2vtx, vtx2xyz_ini, constraints,
+                     sparse_matrix, direct_solver, fix_center ? &center_ini : nullptr,
+                     fix_bottom ? &fix2vtx : nullptr, use_parallel_assembly ? &assembly : nullptr);
+    } else {
+      inflate(vtx2xyz, lambda, volume_trg, tri2vtx, line2vtx, vtx2xyz_ini);
+    }
   }
 
   GLFWwindow *window = pba::window_initialization("task08: Controlling Volume of a Mesh using Lagrange-Multiplier Method");
@@ -16,6 +16,7 @@
 #include "../src/pba_util_gl.h"
 #include "../src/pba_floor_drawer.h"
 #include "../src/pba_eigen_gl.h"
+#include "../src/pba_rigid_body.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846264338327950288
@@ -84,6 +85,25 @@ void step(
   vtx2xyz = ((rotation * vtx2xyz_ini.transpose()).colwise() + translation).transpose();
 }
 
+/**
+ * same as `step` but the energy and its gradient are evaluated in O(1) with the precomputed moments.
+ * The vertices are not transformed here.
+ * @param [in,out] rotation rotation matrix
+ * @param [in,out] translation translation vector
+ * @param [in] rigid_energy energy initialized with the initial coordinates of the mesh's vertices
+ */
+void step_with_moments(
+    Eigen::Matrix3f& rotation,
+    Eigen::Vector3f& translation,
+    const pba::RigidBodyGravityEnergy& rigid_energy){
+  constexpr float learning_rate = 1.0e-6;
+  std::cout << "energy: " << rigid_energy.energy(rotation, translation) << std::endl;
+  Eigen::Vector3f dEdo, dEdt;
+  rigid_energy.gradient(dEdo, dEdt, rotation, translation);
+  translation -= learning_rate * dEdt;
+  rotation = rotation * Eigen::AngleAxisf(-dEdo.norm()*learning_rate, dEdo.stableNormalized());
+}
+
 int main() {
   const auto[tri2vtx, vtx2xyz_ini] = load_my_bunny();
   const auto line2vtx = pba::lines_of_mesh(tri2vtx, static_cast<int>(vtx2xyz_ini.rows()));
@@ -93,6 +113,17 @@ int main() {
   Eigen::Vector3f translation = Eigen::Vector3f::Zero(); // translation to optimize
   Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> vtx2xyz = vtx2xyz_ini; // position after transformation
 
+  // evaluate the energy with the precomputed moments of the vertices and transform the vertices only for drawing
+  constexpr bool use_mass_moments = false;
+  pba::RigidBodyGravityEnergy rigid_energy;
+  rigid_energy.initialize(
+      vtx2xyz_ini, ivtx_fix, vtx2xyz_ini.row(ivtx_fix).transpose(),
+      1.0e+6f, Eigen::Vector3f(0.f, -10.f, 0.f));
+
+  // minimize the energy with the Levenberg-Marquardt method (one iteration per frame) instead of the gradient descent
+  constexpr bool use_levenberg_marquardt = false;
+  pba::RigidBodyLevenbergMarquardt levenberg_marquardt;
+
   GLFWwindow *window = pba::window_initialization("task09: Rotation and Energy Minimization");
   pba::FloorDrawer floor(1.0, -1.5);
 
@@ -101,8 +132,17 @@ int main() {
 
   while (!::glfwWindowShouldClose(window)) {
 
-    step(rotation, translation, vtx2xyz,
-         ivtx_fix, vtx2xyz_ini);
+    if (use_levenberg_marquardt) {
+      const double energy = levenberg_marquardt.iterate(rotation, translation, rigid_energy);
+      std::cout << "energy: " << energy << std::endl;
+      vtx2xyz = ((rotation * vtx2xyz_ini.transpose()).colwise() + translation).transpose();
+    } else if (use_mass_moments) {
+      step_with_moments(rotation, translation, rigid_energy);
+      vtx2xyz = ((rotation * vtx2xyz_ini.transpose()).colwise() + translation).transpose();
+    } else {
+      step(rotation, translation, vtx2xyz,
+           ivtx_fix, vtx2xyz_ini);
+    }
     //
     pba::default_window_3d(window); // start window for 3D visualization
 
@@ -10,6 +10,7 @@
 #include <random>
 #include <filesystem>
 #include <fstream>
+#include <tuple>
 #define GL_SILENCE_DEPRECATION
 #include <GLFW/glfw3.h>
 #include <Eigen/Dense>
@@ -19,6 +20,8 @@
 #include "../src/pba_floor_drawer.h"
 #include "../src/pba_eigen_gl.h"
 #include "../src/pba_util_eigen.h"
+#include "../src/pba_parallel.h"
+#include "../src/pba_rigid_body.h"
 
 /**
  * compute the volume and the center of gravity of 3D solid triangle mesh
@@ -71,7 +74,74 @@ Eigen::Matrix3f inertia_tensor_solid_3d_triangle_mesh(
   return res;
 }
 
-auto load_3d_model() {
+/**
+ * volume, center of gravity and inertia tensor around the center of 3D solid triangle mesh in one pass.
+ * The volume, first and second moments of the tetrahedra connecting each triangle and the origin are summed
+ * in double. The triangles are processed in batches whose coordinates are gathered in the struct-of-arrays layout,
+ * so the loops over a batch are vectorized. Each lane of a batch keeps its own sums, and the chunks of the
+ * triangles are summed in a fixed order (see `pba::parallel_reduce_sum`), hence the result is bit-for-bit
+ * identical for any number of threads. The inertia tensor is moved to the center with the parallel axis theorem.
+ * @param tri2vtx connectivity of a triangle mesh
+ * @param vtx2xyz coordinates
+ * @return volume, center and inertia tensor around the center
+ */
+auto mass_properties_solid_3d_triangle_mesh_parallel(
+    const Eigen::Matrix<int, Eigen::Dynamic, 3, Eigen::RowMajor> &tri2vtx,
+    const Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vtx2xyz) {
+  constexpr unsigned int num_lane = 8; // number of triangles in one batch
+  using Moments = Eigen::Matrix<double, 10, 1>; // volume, first moment (3) and second moment (6) times 6, 24, 120
+  const auto sum = pba::parallel_reduce_sum(tri2vtx.rows(), Moments::Zero().eval(), [&](unsigned int i_tri_begin, unsigned int i_tri_end) {
+    double lane2sum[10][num_lane] = {};
+    for (unsigned int i_tri0 = i_tri_begin; i_tri0 < i_tri_end; i_tri0 += num_lane) {
+      double xyz[3][3][num_lane]; // (node, dimension, lane)
+      for (unsigned int i_lane = 0; i_lane < num_lane; ++i_lane) {
+        const unsigned int i_tri = i_tri0 + i_lane;
+        for (unsigned int i_node = 0; i_node < 3; ++i_node) {
+          for (unsigned int i_dim = 0; i_dim < 3; ++i_dim) {
+            xyz[i_node][i_dim][i_lane] = i_tri < i_tri_end ? vtx2xyz(tri2vtx(i_tri, i_node), i_dim) : 0.; // zero volume for padding
+          }
+        }
+      }
+      for (unsigned int i_lane = 0; i_lane < num_lane; ++i_lane) {
+        const double x0 = xyz[0][0][i_lane], y0 = xyz[0][1][i_lane], z0 = xyz[0][2][i_lane];
+        const double x1 = xyz[1][0][i_lane], y1 = xyz[1][1][i_lane], z1 = xyz[1][2][i_lane];
+        const double x2 = xyz[2][0][i_lane], y2 = xyz[2][1][i_lane], z2 = xyz[2][2][i_lane];
+        const double v = x0 * (y1 * z2 - z1 * y2) + y0 * (z1 * x2 - x1 * z2) + z0 * (x1 * y2 - y1 * x2);
+        const double xa = x0 + x1 + x2, ya = y0 + y1 + y2, za = z0 + z1 + z2;
+        lane2sum[0][i_lane] += v;
+        lane2sum[1][i_lane] += v * xa;
+        lane2sum[2][i_lane] += v * ya;
+        lane2sum[3][i_lane] += v * za;
+        lane2sum[4][i_lane] += v * (x0 * x0 + x1 * x1 + x2 * x2 + xa * xa);
+        lane2sum[5][i_lane] += v * (y0 * y0 + y1 * y1 + y2 * y2 + ya * ya);
+        lane2sum[6][i_lane] += v * (z0 * z0 + z1 * z1 + z2 * z2 + za * za);
+        lane2sum[7][i_lane] += v * (x0 * y0 + x1 * y1 + x2 * y2 + xa * ya);
+        lane2sum[8][i_lane] += v * (y0 * z0 + y1 * z1 + y2 * z2 + ya * za);
+        lane2sum[9][i_lane] += v * (z0 * x0 + z1 * x1 + z2 * x2 + za * xa);
+      }
+    }
+    Moments res = Moments::Zero();
+    for (unsigned int i = 0; i < 10; ++i) {
+      for (unsigned int i_lane = 0; i_lane < num_lane; ++i_lane) { res(i) += lane2sum[i][i_lane]; }
+    }
+    return res;
+  });
+  const double volume = sum(0) / 6.;
+  const Eigen::Vector3d center = Eigen::Vector3d(sum(1), sum(2), sum(3)) / (24. * volume);
+  Eigen::Matrix3d moment2; // integral of x x^T over the solid
+  moment2 << sum(4), sum(7), sum(9),
+      sum(7), sum(5), sum(8),
+      sum(9), sum(8), sum(6);
+  moment2 /= 120.;
+  moment2 -= volume * center * center.transpose(); // parallel axis theorem
+  const Eigen::Matrix3d inertia = moment2.trace() * Eigen::Matrix3d::Identity() - moment2;
+  return std::make_tuple(volume, center, inertia);
+}
+
+/**
+ * @param is_parallel_mass_properties compute the center with `mass_properties_solid_3d_triangle_mesh_parallel`
+ */
+auto load_3d_model(bool is_parallel_mass_properties = false) {
   auto[tri2vtx, vtx2xyz] = pba::load_wavefront_obj(std::filesystem::path(PATH_SOURCE_DIR) / "t-rex.obj");
   { // normalize the size
     auto size = (vtx2xyz.colwise().maxCoeff() - vtx2xyz.colwise().minCoeff()).maxCoeff();
@@ -79,14 +149,20 @@ auto load_3d_model() {
     vtx2xyz *= 2.5;
   }
   // compute volume and the center of gravity
-  auto[volume, center] = volume_center_solid_3d_triangle_mesh(tri2vtx, vtx2xyz);
+  const Eigen::Vector3f center = is_parallel_mass_properties ?
+      std::get<1>(mass_properties_solid_3d_triangle_mesh_parallel(tri2vtx, vtx2xyz)).cast<float>().eval() :
+      volume_center_solid_3d_triangle_mesh(tri2vtx, vtx2xyz).second;
   vtx2xyz.rowwise() -= center.transpose(); // center-ize
   return std::make_pair(tri2vtx, vtx2xyz);
 }
 
 int main() {
-  const auto[tri2vtx, vtx2xyz_ini] = load_3d_model();
-  const Eigen::Matrix3f inertia = inertia_tensor_solid_3d_triangle_mesh(tri2vtx, vtx2xyz_ini);
+  // compute the mass properties in parallel with the double precision
+  constexpr bool use_parallel_mass_properties = false;
+  const auto[tri2vtx, vtx2xyz_ini] = load_3d_model(use_parallel_mass_properties);
+  const Eigen::Matrix3f inertia = use_parallel_mass_properties ?
+      std::get<2>(mass_properties_solid_3d_triangle_mesh_parallel(tri2vtx, vtx2xyz_ini)).cast<float>().eval() :
+      inertia_tensor_solid_3d_triangle_mesh(tri2vtx, vtx2xyz_ini);
 
   GLFWwindow *window = pba::window_initialization("task10: Simulation of Rigid Body Precession");
   pba::FloorDrawer floor(1.0, -1.2);
@@ -101,8 +177,42 @@ int main() {
   Eigen::Vector3f Omega(0.f, 0.05f, 1.f); // initial angular velocity (\dot{R} = R * Skew(\Omega))
   Eigen::Matrix3f rotation = Eigen::Matrix3f::Identity(); // rotation to optimize
 
+  // integrate with the symplectic splitting method with larger time steps instead of the forward Euler method
+  constexpr bool use_splitting_integrator = false;
+  constexpr float dt_splitting = 0.01f; // 10 sub-steps per frame instead of 100
+  // also integrate with the splitting method with a small time step and print the difference of the rotation
+  constexpr bool compare_with_reference = false;
+  constexpr float dt_reference = 0.0001f;
+  pba::FreeRigidBodySplitting splitting;
+  splitting.initialize(inertia.cast<double>());
+  // the states of the splitting method are kept in double. `rotation` is only used for drawing
+  Eigen::Matrix3d rotation_splitting = rotation.cast<double>();
+  Eigen::Vector3d Omega_splitting = Omega.cast<double>();
+  Eigen::Matrix3d rotation_reference = rotation_splitting;
+  Eigen::Vector3d Omega_reference = Omega_splitting;
+
   while (!::glfwWindowShouldClose(window)) {
-    if( time < 200.0 ) {
+    if (time < 200.0 && use_splitting_integrator) {
+      constexpr float time_frame = dt * 100; // same time per frame as the forward Euler method
+      for (int itr = 0; itr < static_cast<int>(time_frame / dt_splitting + 0.5f); ++itr) {
+        splitting.step(rotation_splitting, Omega_splitting, double(dt_splitting));
+      }
+      rotation = rotation_splitting.cast<float>();
+      Omega = Omega_splitting.cast<float>();
+      time += time_frame;
+      const Eigen::Matrix3d inertia_d = inertia.cast<double>();
+      std::cout << "time: " << time << std::endl;
+      std::cout << "   energy: " << Omega_splitting.transpose() * inertia_d * Omega_splitting << std::endl;
+      std::cout << "   angular momentum: " << (rotation_splitting * inertia_d * Omega_splitting).transpose() << std::endl;
+      if (compare_with_reference) {
+        for (int itr = 0; itr < static_cast<int>(time_frame / dt_reference + 0.5f); ++itr) {
+          splitting.step(rotation_reference, Omega_reference, double(dt_reference));
+        }
+        std::cout << "   difference from the reference: " << (rotation_splitting - rotation_reference).norm() << std::endl;
+      }
+      trajectory.emplace_back(vtx2xyz.row(i_vtx_trajectory));
+      vtx2xyz = (rotation * vtx2xyz_ini.transpose()).transpose(); // the rotated mesh's vertices
+    } else if( time < 200.0 ) {
       for (int itr = 0; itr < 100; ++itr) { // sub-stepping
         time += dt;
         // Write some code below to simulate rotation of the rigid body